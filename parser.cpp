@@ -1,5 +1,7 @@
 #include "parser.h"
 
+static_assert(sizeof(KeyPositionType) == 20, "KeyPositionType must stay packed in 20 bytes");
+
 /** Предваряет строку отступом
  * @details  Вспомогательная локальная функция для вывода дерева в ASCII интерфейсе
  * Записывает в строку output строку s, предваряя её отступом indent count_indent раз
@@ -11,6 +13,182 @@
  */
 static void writeWithIndention(std::string& output, const std::string& indent, int count_indent, const std::string& s);
 
+/** Проверка пробельного отрывка
+ * @param [in] data - начало отрывка
+ * @param [in] size - длина отрывка
+ * @return состоит ли отрывок только из пробелов, табуляций и переводов строк
+ */
+static bool isWhitespaceText(const char* data, std::size_t size);
+
+/** Объединение хэшей
+ * @param [in] hash - текущий хэш
+ * @param [in] value - добавляемое значение
+ * @return новый хэш (зависит от порядка добавления)
+ */
+static unsigned long long combineHash(unsigned long long hash, unsigned long long value);
+
+/// Исключение для прекращения построения дерева при превышении бюджета памяти
+struct MemoryBudgetExceeded {};
+
+/// Исключение для прекращения построения дерева при отмене разбора
+struct ParseCancelled {};
+
+/// Исходные данные дерева
+/** @details Находятся в куче и не перемещаются вместе с деревом: узлы ссылаются на них (тексты в text_pool,
+ *  построение отложенных узлов). Общие для дерева и отделённых от него поддеревьев
+ */
+class ParserTreeSource {
+public:
+    // Данные:
+    std::string rude_text;                      ///< Исходный текст
+    std::vector<KeyPositionType> key_positions; ///< Вектор местоположений ключей
+    KeySet keys;                                ///< Множество ключей
+    ParserTree::ParseOptions options;           ///< Параметры разбора
+    std::vector<unsigned int> subtree_ends;     ///< Номер первого местоположения после вложенных в ключ
+    mutable TextPool text_pool;     ///< Хранилище текстовых отрывков узлов (пополняется и при построении отложенных узлов)
+    mutable std::mutex lazy_mutex;  ///< Защита text_pool и items_bytes при построении отложенных узлов
+    mutable std::size_t items_bytes;    ///< Объём памяти построенных узлов
+    std::size_t items_memory_limit; ///< Предел памяти узлов и текстов при построении в createTree() (0 - без проверки)
+    ParseControl* build_control;    ///< Управление разбором при построении в createTree() (nullptr - без управления)
+    mutable std::vector<std::size_t> line_starts;   ///< Индекс начал строк rude_text (см. buildLineIndex())
+    mutable std::once_flag line_index_flag;         ///< Флаг однократного построения индекса строк
+    mutable std::atomic<bool> line_index_built;     ///< Индекс строк построен (для оценки памяти)
+    std::function<void(std::size_t)> growth_callback;   ///< Обработчик роста памяти (см. ParserTree::setMemoryGrowthCallback())
+
+    // Методы:
+    ParserTreeSource(std::string&& text, const ParserTree::ParseOptions& parse_options);
+    void SubTree(std::size_t begin_rude_text_pos, std::size_t end_rude_text_pos,
+                 unsigned int& vector_pos, ParserTreeItem& item) const;
+    void materializeItem(ParserTreeItem& item) const;
+    const std::string* storeText(std::string&& text_part) const;
+    void checkBuildLimits(std::size_t text_pos) const;
+    void buildLineIndex() const;
+    ParserTree::LineColumn lineColumn(std::size_t offset) const;
+    void reportGrowth(std::size_t bytes) const;
+};
+
+
+/* === TextPool === */
+const std::string* TextPool::add(std::string&& text)
+{
+    bytes += sizeof(std::string) + text.capacity();
+    texts.push_back(std::move(text));
+    return &texts.back();
+}
+
+const std::string* TextPool::intern(std::string&& text)
+{
+    count_intern_requests++;
+    std::pair<std::unordered_set<std::string>::iterator, bool> result = interned_texts.insert(std::move(text));
+    if (result.second)
+        bytes += sizeof(std::string) + result.first->capacity();
+    return &*result.first;
+}
+
+
+
+/* === TextIndex === */
+// Добавить текст узла:
+bool TextIndex::addText(unsigned int pre_order, const char* data, std::size_t size, unsigned int& word_num)
+{
+    std::vector<std::string> words;
+    if (containsByte(data, size, '&'))
+    {
+        const std::string decoded_text = decodeHtmlEntities(std::string(data, size));
+        splitWords(decoded_text.data(), decoded_text.size(), words);
+    }
+    else
+        splitWords(data, size, words);
+
+    /* Номера слов узла хранятся 32-битными (один номер пропускается после текста) */
+    if (words.size() > MAX_WORD_NUM - word_num)
+        return false;
+
+    for (std::string& word : words)
+    {
+        std::pair<std::unordered_map<std::string, std::vector<Posting>>::iterator, bool> result =
+                postings.insert(std::make_pair(std::move(word), std::vector<Posting>()));
+        if (result.second)
+            bytes += sizeof(std::string) + result.first->first.capacity() + sizeof(std::vector<Posting>);
+        std::vector<Posting>& word_postings = result.first->second;
+        std::size_t old_capacity = word_postings.capacity();
+        Posting posting = { pre_order, word_num++ };
+        word_postings.push_back(posting);
+        bytes += (word_postings.capacity() - old_capacity) * sizeof(Posting);
+    }
+    word_num++;     // Фраза не переходит в следующий текст узла
+    return true;
+}
+
+// Найти узлы по фразе:
+std::vector<unsigned int> TextIndex::findPhrase(const std::string& phrase) const
+{
+    std::vector<unsigned int> result;
+    std::vector<std::string> words;
+    splitWords(phrase.data(), phrase.size(), words);
+    if (words.empty())
+        return result;
+
+    /* Вхождения слов фразы; самое редкое слово - ведущее */
+    std::vector<const std::vector<Posting>*> word_postings;
+    unsigned int rarest_num = 0;
+    for (const std::string& word : words)
+    {
+        std::unordered_map<std::string, std::vector<Posting>>::const_iterator it = postings.find(word);
+        if (it == postings.end())
+            return result;
+        if (word_postings.empty() || it->second.size() < word_postings[rarest_num]->size())
+            rarest_num = word_postings.size();
+        word_postings.push_back(&it->second);
+    }
+
+    /* Кандидаты - начала фразы: (узел, номер первого слова).
+     *   Для каждого следующего слова оставляем кандидатов, у которых оно стоит на своём месте (слиянием) */
+    auto posting_less = [](const Posting& a, const Posting& b)
+    {
+        return a.pre_order < b.pre_order || (a.pre_order == b.pre_order && a.word_num < b.word_num);
+    };
+    std::vector<Posting> candidates;
+    for (const Posting& posting : *word_postings[rarest_num])
+    {
+        if (posting.word_num < rarest_num)
+            continue;
+        Posting candidate = { posting.pre_order, posting.word_num - rarest_num };
+        candidates.push_back(candidate);
+    }
+    for (unsigned int word_num = 0; word_num < words.size() && !candidates.empty(); word_num++)
+    {
+        if (word_num == rarest_num)
+            continue;
+        const std::vector<Posting>& current = *word_postings[word_num];
+        std::vector<Posting>::const_iterator it = current.begin();
+        std::size_t count_kept = 0;
+        for (const Posting& candidate : candidates)
+        {
+            Posting expected = { candidate.pre_order, candidate.word_num + word_num };
+            it = std::lower_bound(it, current.end(), expected, posting_less);
+            if (it != current.end() && it->pre_order == expected.pre_order && it->word_num == expected.word_num)
+                candidates[count_kept++] = candidate;
+        }
+        candidates.resize(count_kept);
+    }
+
+    for (const Posting& candidate : candidates)
+        if (result.empty() || result.back() != candidate.pre_order)
+            result.push_back(candidate.pre_order);
+    return result;
+}
+
+// Очистить индекс:
+void TextIndex::clear()
+{
+    postings.clear();
+    bytes = 0;
+}
+
+//===============================================
+
+
 /* === KeyType == */
 KeyType::KeyType(const std::string& key_name) : name(key_name), search_position_functions(findSearchFunction(key_name))
 {
@@ -19,27 +197,229 @@ KeyType::KeyType(const std::string& key_name) : name(key_name), search_position_
 //===============================================
 
 
+/* === KeySet === */
+/** Имя тега ключа
+ * @details Слово между '<' и первым пробелом или '>': "div" для "<div> </div>"
+ * @param [in] key_name - имя ключа
+ * @return имя тега (пустое для корневого ключа)
+ */
+static std::string keyTagName(const std::string& key_name)
+{
+    if (key_name.empty())
+        return "";
+    std::string::size_type end_tag_name = key_name.find_first_of(" >", 1);
+    return key_name.substr(1, end_tag_name == std::string::npos ? std::string::npos : end_tag_name - 1);
+}
+
+// Конструктор:
+KeySet::KeySet() : id(0), case_insensitive(false)
+{
+    add(KeyType(""));
+}
+
+// Добавить ключ:
+TagId KeySet::add(const KeyType& key)
+{
+    std::string tag_name = keyTagName(key.getName());
+    std::map<std::string, TagId>::const_iterator it = tag_ids.find(case_insensitive ? toLowerAscii(tag_name) : tag_name);
+    if (it != tag_ids.end())
+        return it->second;
+    if (keys.size() >= NO_TAG_ID)
+        return NO_TAG_ID;
+
+    TagId tag_id = static_cast<TagId>(keys.size());
+    id = hashBytes(key.getName().data(), key.getName().size(), id);
+    keys.push_back(key);
+    tag_names.push_back(tag_name);
+    tag_ids.insert(std::make_pair(case_insensitive ? toLowerAscii(tag_name) : tag_name, tag_id));
+    return tag_id;
+}
+
+// Сравнение без учёта регистра:
+void KeySet::setCaseInsensitive(bool ignore_case)
+{
+    if (ignore_case == case_insensitive)
+        return;
+    case_insensitive = ignore_case;
+
+    /* Перестраиваем таблицу идентификаторов (при совпадении имён остаётся первый ключ) */
+    tag_ids.clear();
+    for (TagId tag_id = 0; tag_id < tag_names.size(); tag_id++)
+        tag_ids.insert(std::make_pair(case_insensitive ? toLowerAscii(tag_names[tag_id]) : tag_names[tag_id], tag_id));
+}
+
+// Считать список ключей с файла:
+bool KeySet::readFromFile(std::ifstream& fin)
+{
+    const std::string empty_element[] = {
+        "area", "base", "br", "col", "command", "embed", "hr", "img",
+        "input", "keygen", "link", "meta", "param", "source", "track", "wbr"
+    };
+    const std::string * p_str_begin = empty_element;
+    const std::string * p_str_end = empty_element + sizeof(empty_element) / sizeof(*empty_element);
+
+    /* Проверка на успешность открытия файла */
+    if (!fin.is_open())
+        return false;
+
+    /* Считывание строк с файла */
+    std::string cur_str;
+    std::getline(fin, cur_str);
+    while (fin)
+    {
+        cur_str += '\n';       // Восстановление исходной строки (как в файле)
+        /* Пропускаем строки, начинающиеся с '#' */
+        if (cur_str[0] == '#')
+        {
+            std::getline(fin, cur_str);
+            continue;
+        }
+        /* Пропускаем пустые строки */
+        if (cur_str.find_first_not_of(" \t\n") == std::string::npos)
+        {
+            std::getline(fin, cur_str);
+            continue;
+        }
+
+        /* Устанавливаем ключи */
+        std::size_t begin_key_word = cur_str.find_first_not_of(" \t\n");
+        std::size_t end_key_word;
+        std::string key_word;
+        while ( begin_key_word < cur_str.size())
+        {
+            end_key_word = cur_str.find_first_of(" \t\n",  begin_key_word);
+            key_word = std::move(cur_str.substr( begin_key_word, end_key_word -  begin_key_word));
+            if (std::find(p_str_begin, p_str_end, key_word) != p_str_end)
+                add(KeyType("<" + key_word + ">"));
+            else
+                add(KeyType("<" + key_word + "> </" + key_word + ">"));
+            begin_key_word = cur_str.find_first_not_of(" \t\n", end_key_word + 1);
+        }
+
+        /* Считываем следующую строку */
+        std::getline(fin, cur_str);
+    }
+
+    return true;
+}
+
+// Найти идентификатор по имени тега:
+TagId KeySet::findTagId(const std::string& tag_name) const
+{
+    std::map<std::string, TagId>::const_iterator it = tag_ids.find(case_insensitive ? toLowerAscii(tag_name) : tag_name);
+    return it != tag_ids.end() ? it->second : NO_TAG_ID;
+}
+
+// Найти идентификатор ключа:
+TagId KeySet::findKeyTagId(const KeyType& key) const
+{
+    return findTagId(keyTagName(key.getName()));
+}
+
+// Пустой элемент:
+bool KeySet::isEmptyElement(TagId tag_id) const
+{
+    return tag_id != ROOT_TAG_ID && keys[tag_id].getName().find(' ') == std::string::npos;
+}
+
+//===============================================
+
+
 /* === ParserTreeItem === */
+/// Кэш декодированных текстов узла
+struct ParserTreeItem::DecodeCache
+{
+    std::mutex mutex;                                   ///< Защита кэша
+    std::vector<DecodeState> text_decode_states;        ///< Состояния декодирования текстов
+    std::map<unsigned int, std::string> decoded_texts;  ///< Декодированные тексты, содержащие сущности
+};
+
 // Конструктор:
-ParserTreeItem::ParserTreeItem(const KeyType& k, int row_position, int column_position)
-    : key(k), row(row_position), column(column_position)
+ParserTreeItem::ParserTreeItem(TagId id, unsigned int position_num, int row_position, int column_position)
+    : tag_id(id), key_position_num(position_num), source(nullptr), lazy(false), parent(nullptr),
+      pre_order(position_num + 1), subtree_end(position_num + 2), decode_cache(nullptr), row(row_position), column(column_position)
+{
+}
+
+// Деструктор:
+ParserTreeItem::~ParserTreeItem()
+{
+    delete decode_cache.load(std::memory_order_relaxed);
+}
+
+// Построение данных отложенного узла:
+void ParserTreeItem::materialize() const
 {
+    if (lazy)
+        std::call_once(materialize_flag, [this]() { source->materializeItem(const_cast<ParserTreeItem&>(*this)); });
 }
 
 // Чтение полей класса:
-const KeyType& ParserTreeItem::getKey() const                             { return key; }
-const std::vector<std::string>& ParserTreeItem::getTexts() const          { return texts; }
-const std::vector<ParserTreeItem*>& ParserTreeItem::getChilds() const     { return childs; }
+TagId ParserTreeItem::getTagId() const                                    { return tag_id; }
+unsigned int ParserTreeItem::getKeyPositionNum() const                    { return key_position_num; }
+const std::vector<const std::string*>& ParserTreeItem::getTexts() const   { materialize(); return texts; }
+const std::vector<ParserTreeItem*>& ParserTreeItem::getChilds() const     { materialize(); return childs; }
 const std::vector<ParserTreeItem::TextOrChild>& ParserTreeItem::getLocationSequenceOfData() const
 {
+    materialize();
     return location_sequence_of_data;
 }
+const std::string& ParserTreeItem::getDecodedText(unsigned int text_num) const
+{
+    materialize();
+
+    /* Кэш создаётся при первом обращении; если его одновременно создал другой поток, берём тот */
+    DecodeCache* p_cache = decode_cache.load(std::memory_order_acquire);
+    if (p_cache == nullptr)
+    {
+        DecodeCache* p_new_cache = new DecodeCache;
+        if (decode_cache.compare_exchange_strong(p_cache, p_new_cache, std::memory_order_acq_rel))
+            p_cache = p_new_cache;
+        else
+            delete p_new_cache;
+    }
+
+    std::lock_guard<std::mutex> lock(p_cache->mutex);
+    if (text_num >= p_cache->text_decode_states.size() || p_cache->text_decode_states[text_num] == NOT_DECODED)
+        decodeText(*p_cache, text_num);
+    if (p_cache->text_decode_states[text_num] == NO_ENTITIES)
+        return *texts[text_num];
+    return p_cache->decoded_texts.find(text_num)->second;
+}
+
+void ParserTreeItem::decodeText(DecodeCache& cache, unsigned int text_num) const
+{
+    if (cache.text_decode_states.size() <= text_num)
+        cache.text_decode_states.resize(text_num + 1, NOT_DECODED);
+
+    const std::string& text = *texts[text_num];
+    if (containsByte(text.data(), text.size(), '&'))
+    {
+        cache.decoded_texts[text_num] = decodeHtmlEntities(text);
+        cache.text_decode_states[text_num] = DECODED;
+    }
+    else
+        cache.text_decode_states[text_num] = NO_ENTITIES;
+}
+
+void ParserTreeItem::clearDecodeCache()
+{
+    delete decode_cache.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+ParserTreeItem* ParserTreeItem::getParent() const       { return parent; }
+unsigned int ParserTreeItem::getPreOrder() const        { return pre_order; }
+unsigned int ParserTreeItem::getSubtreeEnd() const      { return subtree_end; }
+bool ParserTreeItem::isAncestorOf(const ParserTreeItem& item) const
+{
+    return pre_order < item.pre_order && item.pre_order < subtree_end;
+}
 int ParserTreeItem::getRow() const      { return row; }
 int ParserTreeItem::getColumn() const   { return column; }
 
 
 // Установка полей класса:
-void ParserTreeItem::addText(const std::string& text_part)
+void ParserTreeItem::addText(const std::string* text_part)
 {
     location_sequence_of_data.push_back(TEXT);
     texts.push_back(text_part);
@@ -52,251 +432,1267 @@ void ParserTreeItem::addChild(ParserTreeItem *item)
     childs.push_back(item);
 }
 
-void ParserTreeItem::deleteLastText()
-{
-    location_sequence_of_data.pop_back();
-    texts.pop_back();
+void ParserTreeItem::deleteLastText()
+{
+    location_sequence_of_data.pop_back();
+    texts.pop_back();
+    DecodeCache* p_cache = decode_cache.load(std::memory_order_relaxed);
+    if (p_cache != nullptr && p_cache->text_decode_states.size() > texts.size())
+    {
+        p_cache->text_decode_states.resize(texts.size());
+        p_cache->decoded_texts.erase(texts.size());
+    }
+}
+
+void ParserTreeItem::deleteLastChild()
+{
+    ParserTreeItem* const p_child = this->childs.back();
+    ParserTreeItem* p_item = p_child;
+
+    /* Удаление дочерних элементов требуемого узла: */
+
+    /* Спускаемся к крайнему правому нижнему узлу, удаляем его и поднимаемся
+        по ссылке на родителя: ветка удаляется справа налево без стека */
+    while (p_item != p_child || !p_item->childs.empty())
+    {
+        if (!p_item->childs.empty())
+        {
+            p_item = p_item->childs.back();
+            continue;
+        }
+        ParserTreeItem* p_parent = p_item->parent;
+        delete p_item;
+        p_parent->childs.pop_back();
+        p_item = p_parent;
+    }
+
+    /* Удаление требуемого узла: */
+    delete p_child;
+    if (this->location_sequence_of_data.back() == TEXT)
+    {
+        this->location_sequence_of_data.pop_back();
+        this->location_sequence_of_data.back() = TEXT;
+    }
+    else
+        this->location_sequence_of_data.pop_back();
+    this->childs.pop_back();
+}
+
+
+//==========================================================
+
+/* === ParserTreePreOrderIterator === */
+// Следующий узел:
+ParserTreePreOrderIterator& ParserTreePreOrderIterator::operator++()
+{
+    /* Первый дочерний узел */
+    const std::vector<ParserTreeItem*>& childs = item->getChilds();
+    if (!childs.empty())
+    {
+        item = childs.front();
+        return *this;
+    }
+
+    /* Иначе следующий брат ближайшего предка (внутри поддерева), у которого он есть */
+    while (item != subtree_root)
+    {
+        const ParserTreeItem* p_parent = item->getParent();
+        unsigned int next_column = item->getColumn() + 1;
+        if (next_column < p_parent->getChilds().size())
+        {
+            item = p_parent->getChilds()[next_column];
+            return *this;
+        }
+        item = p_parent;
+    }
+    item = nullptr;
+    return *this;
+}
+
+
+/* === ParserTreePostOrderIterator === */
+// Конструктор:
+ParserTreePostOrderIterator::ParserTreePostOrderIterator(const ParserTreeItem* subtree)
+    : item(subtree), subtree_root(subtree)
+{
+    /* Самый левый лист поддерева */
+    while (item != nullptr && !item->getChilds().empty())
+        item = item->getChilds().front();
+}
+
+// Следующий узел:
+ParserTreePostOrderIterator& ParserTreePostOrderIterator::operator++()
+{
+    if (item == subtree_root)
+    {
+        item = nullptr;
+        return *this;
+    }
+
+    /* Самый левый лист следующего брата или, если брата нет, родитель */
+    const ParserTreeItem* p_parent = item->getParent();
+    unsigned int next_column = item->getColumn() + 1;
+    if (next_column < p_parent->getChilds().size())
+    {
+        item = p_parent->getChilds()[next_column];
+        while (!item->getChilds().empty())
+            item = item->getChilds().front();
+    }
+    else
+        item = p_parent;
+    return *this;
+}
+
+
+//==========================================================
+
+/* === ParserTreeSource === */
+// Конструктор:
+ParserTreeSource::ParserTreeSource(std::string&& text, const ParserTree::ParseOptions& parse_options)
+    : rude_text(std::move(text)), options(parse_options),
+      items_bytes(sizeof(ParserTreeItem)), items_memory_limit(0), build_control(nullptr), line_index_built(false)
+{
+}
+
+
+// Создаем поддерево (рекурсивно):
+void ParserTreeSource::SubTree(std::size_t begin_rude_text_pos, std::size_t end_rude_text_pos,
+                                 unsigned int& vector_pos, ParserTreeItem& item) const
+{
+    std::size_t text_pos = begin_rude_text_pos;        // position in rude_text
+                                                 // vector_pos = (max - 1) number used key position in key_positions
+    int child_num = 0;      // item.getChilds() can't be used: it materializes lazy item
+
+    /* Add text [text_pos, end_temp_pos); with overlapping tags (<b><i></b></i>) a child key area
+     *   can end after end_rude_text_pos, then the text is empty */
+    auto add_text = [this, &item, &text_pos](std::size_t end_temp_pos)
+    {
+        if (text_pos >= end_temp_pos)
+            return;
+        const std::string* p_text = storeText(rude_text.substr(text_pos, end_temp_pos - text_pos));
+        if (p_text != nullptr)
+        {
+            item.addText(p_text);
+            items_bytes += sizeof(const std::string*) + sizeof(ParserTreeItem::TextOrChild);
+            checkBuildLimits(text_pos);
+        }
+    };
+
+    /* Child keys begin before the end of item data (as in ParserTree::findSubtreeEnds()) */
+    while (vector_pos < key_positions.size() && key_positions[vector_pos].getBeginKeyAreaPosition() < end_rude_text_pos)
+    {
+        unsigned int child_vector_pos = vector_pos;
+        add_text(key_positions[child_vector_pos].getBeginKeyAreaPosition());
+
+        /* Add new item */
+        ParserTreeItem * p_child = new ParserTreeItem(
+                    key_positions[child_vector_pos].getTagId(), child_vector_pos, item.getRow() + 1, child_num++);
+        item.addChild(p_child);
+        p_child->parent = &item;
+        p_child->source = this;
+        items_bytes += sizeof(ParserTreeItem) + sizeof(ParserTreeItem*) + sizeof(ParserTreeItem::TextOrChild);
+        checkBuildLimits(std::max(text_pos, key_positions[child_vector_pos].getBeginKeyAreaPosition()));
+        /* Lazy tree: child data is built on first access, skip nested keys */
+        if (options.lazy_tree)
+        {
+            p_child->lazy = true;
+            vector_pos = subtree_ends[child_vector_pos];
+        }
+        else
+        {
+            vector_pos++;
+            SubTree(key_positions[child_vector_pos].getBeginDataPosition(), key_positions[child_vector_pos].getEndDataPosition(), vector_pos, *p_child);
+        }
+        p_child->subtree_end = vector_pos + 1;      // pre-order number = key position number + 1
+        text_pos = std::max(text_pos, key_positions[child_vector_pos].getEndKeyAreaPosition());
+    }
+    add_text(end_rude_text_pos);
+}
+
+
+// Построить данные отложенного узла (только его дочерние узлы и тексты):
+void ParserTreeSource::materializeItem(ParserTreeItem& item) const
+{
+    std::size_t growth_bytes;
+    {
+        std::lock_guard<std::mutex> lock(lazy_mutex);   // text_pool общий для всех узлов
+        std::size_t old_bytes = items_bytes + text_pool.getBytes();
+        unsigned int vector_pos = item.getKeyPositionNum() + 1;
+        const KeyPositionType& key_position = key_positions[item.getKeyPositionNum()];
+        SubTree(key_position.getBeginDataPosition(), key_position.getEndDataPosition(), vector_pos, item);
+        growth_bytes = items_bytes + text_pool.getBytes() - old_bytes;
+    }
+    reportGrowth(growth_bytes);
+}
+
+// Сообщить о росте памяти (вне блокировок):
+void ParserTreeSource::reportGrowth(std::size_t bytes) const
+{
+    if (bytes != 0 && growth_callback)
+        growth_callback(bytes);
+}
+
+
+// Проверка предела памяти узлов и текстов и отмены при построении дерева:
+void ParserTreeSource::checkBuildLimits(std::size_t text_pos) const
+{
+    if (items_memory_limit != 0 && items_bytes + text_pool.getBytes() > items_memory_limit)
+        throw MemoryBudgetExceeded();
+    if (build_control != nullptr)
+    {
+        if (build_control->isCancelled())
+            throw ParseCancelled();
+        /* Построение дерева просматривает текст после поиска всех ключей */
+        build_control->setBytesScanned(rude_text.size() * (keys.size() - 1) + text_pos);
+    }
+}
+
+// Построить индекс начал строк (один раз):
+void ParserTreeSource::buildLineIndex() const
+{
+    std::call_once(line_index_flag, [this]()
+    {
+        findLineStarts(rude_text, line_starts);
+        line_index_built.store(true, std::memory_order_release);
+        reportGrowth(line_starts.capacity() * sizeof(std::size_t));
+    });
+}
+
+// Строка и колонка позиции:
+ParserTree::LineColumn ParserTreeSource::lineColumn(std::size_t offset) const
+{
+    buildLineIndex();
+    /* Последнее начало строки, не превышающее offset */
+    std::vector<std::size_t>::const_iterator it = std::upper_bound(line_starts.cbegin(), line_starts.cend(), offset) - 1;
+    ParserTree::LineColumn line_column;
+    line_column.line = static_cast<std::size_t>(it - line_starts.cbegin()) + 1;
+    line_column.column = offset - *it + 1;
+    return line_column;
+}
+
+// Сохранить текстовый отрывок в text_pool с учётом параметров разбора:
+// Возвращает nullptr, если отрывок не нужно добавлять в дерево
+const std::string* ParserTreeSource::storeText(std::string&& text_part) const
+{
+    if (options.whitespace_mode != ParserTree::KEEP_WHITESPACE && isWhitespaceText(text_part.data(), text_part.size()))
+    {
+        if (options.whitespace_mode == ParserTree::DROP_WHITESPACE)
+            return nullptr;
+        /* Свёрнутых вариантов всего два, поэтому они интернируются всегда */
+        return text_pool.intern(text_part.find('\n') != std::string::npos ? "\n" : " ");
+    }
+
+    if (options.intern_texts && text_part.size() <= options.max_interned_text_length)
+        return text_pool.intern(std::move(text_part));
+    return text_pool.add(std::move(text_part));
+}
+
+
+//==========================================================
+
+/* === ParserTree === */
+
+// Конструктор:
+ParserTree::ParserTree(std::string text, const ParseOptions& parse_options)
+    : source(std::make_shared<ParserTreeSource>(std::move(text), parse_options)),
+      root_item(new ParserTreeItem(KeySet::ROOT_TAG_ID, ParserTreeItem::ROOT_KEY_POSITION_NUM, 0, 0)), error_description(),
+      text_index_valid(false), items_match_source(false), indices_valid(false), indices_mutex(new std::mutex)
+{
+    root_item->source = source.get();
+
+    /* Проверка на пустую строку */
+    if (source->rude_text.empty())
+        error_description += "Input text is empty;\n";
+
+    /* Считываем список ключей с файла */
+    std::ifstream fin(Key_list_filename);
+    if (!fin.is_open())
+    {
+        error_description += "File with tag list can't be opened;\n";
+        return;
+    }
+    readKeysFromFile(fin);
+    fin.close();
+
+    parseText();
+}
+
+ParserTree::ParserTree(std::string text, const KeySet& key_set, const ParseOptions& parse_options)
+    : source(std::make_shared<ParserTreeSource>(std::move(text), parse_options)),
+      root_item(new ParserTreeItem(KeySet::ROOT_TAG_ID, ParserTreeItem::ROOT_KEY_POSITION_NUM, 0, 0)), error_description(),
+      text_index_valid(false), items_match_source(false), indices_valid(false), indices_mutex(new std::mutex)
+{
+    root_item->source = source.get();
+    source->keys = key_set;
+
+    /* Проверка на пустую строку */
+    if (source->rude_text.empty())
+        error_description += "Input text is empty;\n";
+
+    parseText();
+}
+
+// Пустое дерево над готовыми исходными данными (для detachSubtree()):
+ParserTree::ParserTree(const std::shared_ptr<ParserTreeSource>& tree_source,
+                       const std::vector<std::shared_ptr<ParserTreeSource>>& tree_spliced_sources)
+    : source(tree_source), spliced_sources(tree_spliced_sources),
+      root_item(new ParserTreeItem(KeySet::ROOT_TAG_ID, ParserTreeItem::ROOT_KEY_POSITION_NUM, 0, 0)), error_description(),
+      text_index_valid(false), items_match_source(false), indices_valid(false), indices_mutex(new std::mutex)
+{
+    root_item->source = source.get();
+}
+
+// Конструктор перемещения:
+ParserTree::ParserTree(ParserTree&& tree)
+    : source(std::move(tree.source)), spliced_sources(std::move(tree.spliced_sources)), root_item(tree.root_item),
+      error_description(std::move(tree.error_description)), last_find(std::move(tree.last_find)),
+      tag_index(std::move(tree.tag_index)), content_hashes(std::move(tree.content_hashes)),
+      dirty_items(std::move(tree.dirty_items)), carried_hashes(std::move(tree.carried_hashes)),
+      text_index(std::move(tree.text_index)), text_index_valid(tree.text_index_valid.load()),
+      items_match_source(tree.items_match_source), indices_valid(tree.indices_valid.load()), indices_mutex(std::move(tree.indices_mutex))
+{
+    tree.root_item = nullptr;
+}
+
+// Перемещающее присваивание:
+ParserTree& ParserTree::operator=(ParserTree&& tree)
+{
+    if (this == &tree)
+        return *this;
+
+    deleteItems();
+    root_item = tree.root_item;
+    tree.root_item = nullptr;
+    source = std::move(tree.source);
+    spliced_sources = std::move(tree.spliced_sources);
+    error_description = std::move(tree.error_description);
+    last_find = std::move(tree.last_find);
+    tag_index = std::move(tree.tag_index);
+    content_hashes = std::move(tree.content_hashes);
+    dirty_items = std::move(tree.dirty_items);
+    carried_hashes = std::move(tree.carried_hashes);
+    text_index = std::move(tree.text_index);
+    text_index_valid = tree.text_index_valid.load();
+    items_match_source = tree.items_match_source;
+    indices_valid = tree.indices_valid.load();
+    indices_mutex = std::move(tree.indices_mutex);
+    return *this;
+}
+
+
+// Создать дерево:
+// TODO: Описать ошибки (строка, которую не обработать)
+bool ParserTree::createTree()
+{
+    /* Управление разбором нужно только до конца createTree(): указатель сбрасывается при любом выходе */
+    ParserTreeSource& tree_source = *source;
+    struct BuildControlReset
+    {
+        ParserTreeSource& tree_source;
+        ~BuildControlReset()        { tree_source.build_control = nullptr; }
+    } build_control_reset = { tree_source };
+    tree_source.build_control = tree_source.options.control;
+    tree_source.options.control = nullptr;
+
+    /* Проверка на ошибки, созданные в конструкторе */
+    if (error_description.empty() == false)
+        return false;
+
+    /* Повторное построение создало бы вторые узлы для тех же ключей (в том числе для ключей поддеревьев,
+     *   отделённых detachSubtree() и разделяющих исходные данные) */
+    if (!tree_source.subtree_ends.empty() || !root_item->location_sequence_of_data.empty())
+    {
+        error_description += "Tree is already created;\n";
+        return false;
+    }
+
+    /* Создаем дерево рекурсивной функцией SubTree
+     * (отложенное дерево - только дочерние узлы коренного) */
+    try
+    {
+        findSubtreeEnds();
+        computeContentHashes();
+        /* Индекс узлов по ключам: номера в прямом порядке обхода совпадают с номерами местоположений + 1 */
+        const std::vector<KeyPositionType>& key_positions = tree_source.key_positions;
+        tag_index.assign(tree_source.keys.size(), std::vector<unsigned int>());
+        for (unsigned int vector_pos = 0; vector_pos < key_positions.size(); vector_pos++)
+            tag_index[key_positions[vector_pos].getTagId()].push_back(vector_pos + 1);
+        if (tree_source.options.text_index && !indexSourceTexts())
+        {
+            releaseTree();
+            error_description += "Too many words in texts of an item (limit " + std::to_string(TextIndex::MAX_WORD_NUM) + ");\n";
+            return false;
+        }
+
+        /* Остаток бюджета памяти - на узлы и тексты */
+        std::size_t fixed_bytes = tree_source.rude_text.capacity() + keyPositionsBytes();
+        if (isMemoryBudgetExceeded(fixed_bytes))
+            throw MemoryBudgetExceeded();
+        if (tree_source.options.memory_budget != 0)
+            tree_source.items_memory_limit = tree_source.options.memory_budget - fixed_bytes;
+
+        root_item->subtree_end = key_positions.size() + 1;
+        unsigned int vector_position = 0;
+        tree_source.SubTree(0, tree_source.rude_text.size(), vector_position, *root_item);
+        tree_source.items_memory_limit = 0;
+        if (tree_source.build_control != nullptr)
+            tree_source.build_control->setBytesScanned(tree_source.build_control->getBytesTotal());
+        items_match_source = true;
+        indices_valid = true;
+    }
+    catch (const ParseCancelled&)
+    {
+        releaseTree();
+        error_description += "Parsing cancelled;\n";
+        return false;
+    }
+    catch (const MemoryBudgetExceeded&)
+    {
+        releaseTree();
+        error_description += "Memory budget exceeded (" + std::to_string(tree_source.options.memory_budget) + " bytes);\n";
+        return false;
+    }
+    catch (const std::bad_alloc&)
+    {
+        releaseTree();
+        error_description += "Not enough memory;\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Деструктор:
+ParserTree::~ParserTree()
+{
+    deleteItems();
+}
+
+
+// Поиск данных по ключу:
+ParserTree& ParserTree::find(const KeyType& key)
+{
+    last_find = findItems(key);
+    return *this;
+}
+
+std::vector<ParserTreeItem*> ParserTree::findItems(const KeyType& key) const
+{
+    updateIndices();
+    std::vector<ParserTreeItem*> result;
+    TagId tag_id = source->keys.findKeyTagId(key);
+    if (tag_id == KeySet::NO_TAG_ID || tag_id >= tag_index.size())
+        return result;
+
+    for (unsigned int pre_order : tag_index[tag_id])
+        result.push_back(findItemByPreOrder(pre_order));
+    return result;
+}
+
+ParserTree& ParserTree::findNested(const KeyType& key)
+{
+    last_find = findNestedItems(last_find, key);
+    return *this;
+}
+
+std::vector<ParserTreeItem*> ParserTree::findNestedItems(const std::vector<ParserTreeItem*>& ancestor_items, const KeyType& key) const
+{
+    updateIndices();
+    std::vector<ParserTreeItem*> result;
+    TagId tag_id = source->keys.findKeyTagId(key);
+    if (tag_id == KeySet::NO_TAG_ID || tag_id >= tag_index.size())
+        return result;
+
+    /* Для каждого предка - отрезок индекса ключа внутри его поддерева;
+     *   вложенные в предыдущий предки пропускаются, чтобы не повторять узлы */
+    std::vector<ParserTreeItem*> ancestors(ancestor_items);
+    std::sort(ancestors.begin(), ancestors.end(), [](const ParserTreeItem* a, const ParserTreeItem* b)
+    {
+        return a->getPreOrder() < b->getPreOrder();
+    });
+    const std::vector<unsigned int>& tag_items = tag_index[tag_id];
+    unsigned int covered_end = 0;
+    for (const ParserTreeItem* p_ancestor : ancestors)
+    {
+        if (p_ancestor->getPreOrder() < covered_end)
+            continue;
+        covered_end = p_ancestor->getSubtreeEnd();
+        std::vector<unsigned int>::const_iterator it = std::upper_bound(tag_items.begin(), tag_items.end(), p_ancestor->getPreOrder());
+        std::vector<unsigned int>::const_iterator it_end = std::lower_bound(it, tag_items.end(), p_ancestor->getSubtreeEnd());
+        for (; it != it_end; ++it)
+            result.push_back(findItemByPreOrder(*it));
+    }
+    return result;
+}
+
+// Поиск узлов по тексту:
+ParserTree& ParserTree::findText(const std::string& phrase)
+{
+    if (!buildTextIndex())
+        error_description += "Too many words in texts of an item (limit " + std::to_string(TextIndex::MAX_WORD_NUM) + ");\n";
+    last_find = findTextItems(phrase);
+    return *this;
+}
+
+std::vector<ParserTreeItem*> ParserTree::findTextItems(const std::string& phrase) const
+{
+    std::vector<ParserTreeItem*> result;
+    if (!buildTextIndex())
+        return result;
+    for (unsigned int pre_order : text_index.findPhrase(phrase))
+        result.push_back(findItemByPreOrder(pre_order));
+    return result;
+}
+
+// Потомки узла с заданным ключом:
+std::vector<ParserTreeItem*> ParserTree::findDescendants(const ParserTreeItem& ancestor, TagId tag_id) const
+{
+    updateIndices();
+    std::vector<ParserTreeItem*> result;
+    if (tag_id >= tag_index.size())
+        return result;
+
+    const std::vector<unsigned int>& tag_items = tag_index[tag_id];
+    std::vector<unsigned int>::const_iterator it = std::upper_bound(tag_items.begin(), tag_items.end(), ancestor.getPreOrder());
+    std::vector<unsigned int>::const_iterator it_end = std::lower_bound(it, tag_items.end(), ancestor.getSubtreeEnd());
+    for (; it != it_end; ++it)
+        result.push_back(findItemByPreOrder(*it));
+    return result;
+}
+
+// Узел по номеру в прямом порядке обхода:
+ParserTreeItem* ParserTree::findItemByPreOrder(unsigned int pre_order) const
+{
+    updateIndices();
+    if (pre_order >= root_item->getSubtreeEnd())
+        return nullptr;
+
+    /* Спускаемся от корня: дочерние узлы упорядочены по номерам */
+    ParserTreeItem* p_item = root_item;
+    while (p_item->getPreOrder() != pre_order)
+    {
+        const std::vector<ParserTreeItem*>& childs = p_item->getChilds();
+        std::vector<ParserTreeItem*>::const_iterator it = std::upper_bound(childs.begin(), childs.end(), pre_order,
+            [](unsigned int n, const ParserTreeItem* p_child) { return n < p_child->getPreOrder(); });
+        if (it == childs.begin())
+            return nullptr;
+        p_item = *(it - 1);
+    }
+    return p_item;
+}
+
+const std::vector<ParserTreeItem*>& ParserTree::getLastFind() const    { return last_find; }
+
+
+// Хэш содержимого узла:
+unsigned long long ParserTree::getContentHash(const ParserTreeItem& item) const
+{
+    updateIndices();
+    return content_hashes[item.getPreOrder()];
+}
+
+
+// Сравнение деревьев:
+std::vector<ParserTree::TreeDifference> ParserTree::diff(const ParserTree& new_tree) const
+{
+    std::vector<TreeDifference> differences;
+    updateIndices();
+    new_tree.updateIndices();
+    if (content_hashes.empty() || new_tree.content_hashes.empty())
+        return differences;
+    diffItems(*root_item, new_tree, *new_tree.root_item, differences);
+    return differences;
+}
+
+void ParserTree::diffItems(const ParserTreeItem& old_item, const ParserTree& new_tree, const ParserTreeItem& new_item,
+                           std::vector<TreeDifference>& differences) const
+{
+    /* Одинаковые поддеревья не просматриваем */
+    if (getContentHash(old_item) == new_tree.getContentHash(new_item))
+        return;
+
+    /* Изменился сам узел: ключ или тексты */
+    bool item_changed = getItemTagName(old_item) != new_tree.getItemTagName(new_item)
+                        || old_item.getTexts().size() != new_item.getTexts().size();
+    for (unsigned int text_num = 0; !item_changed && text_num < old_item.getTexts().size(); text_num++)
+        item_changed = *old_item.getTexts()[text_num] != *new_item.getTexts()[text_num];
+    if (item_changed)
+    {
+        TreeDifference difference = { TreeDifference::CHANGED, &old_item, &new_item };
+        differences.push_back(difference);
+    }
+
+    /* Сопоставляем дочерние узлы: общие начало и конец, затем одинаковые хэши в середине */
+    const std::vector<ParserTreeItem*>& old_childs = old_item.getChilds();
+    const std::vector<ParserTreeItem*>& new_childs = new_item.getChilds();
+    std::size_t begin_num = 0, old_end_num = old_childs.size(), new_end_num = new_childs.size();
+    while (begin_num < old_end_num && begin_num < new_end_num
+           && getContentHash(*old_childs[begin_num]) == new_tree.getContentHash(*new_childs[begin_num]))
+        begin_num++;
+    while (old_end_num > begin_num && new_end_num > begin_num
+           && getContentHash(*old_childs[old_end_num - 1]) == new_tree.getContentHash(*new_childs[new_end_num - 1]))
+    {
+        old_end_num--;
+        new_end_num--;
+    }
+
+    std::multimap<unsigned long long, std::size_t> new_by_hash;
+    for (std::size_t new_num = begin_num; new_num < new_end_num; new_num++)
+        new_by_hash.insert(std::make_pair(new_tree.getContentHash(*new_childs[new_num]), new_num));
+    std::vector<bool> new_matched(new_end_num - begin_num, false);
+    std::vector<std::size_t> old_unmatched;
+    for (std::size_t old_num = begin_num; old_num < old_end_num; old_num++)
+    {
+        std::multimap<unsigned long long, std::size_t>::iterator it = new_by_hash.find(getContentHash(*old_childs[old_num]));
+        if (it != new_by_hash.end())
+        {
+            new_matched[it->second - begin_num] = true;
+            new_by_hash.erase(it);
+        }
+        else
+            old_unmatched.push_back(old_num);
+    }
+
+    /* Оставшиеся узлы с одинаковыми ключами сравниваем рекурсивно (по порядку), остальные - удалены или вставлены */
+    std::size_t new_num = begin_num;
+    for (std::size_t old_num : old_unmatched)
+    {
+        const std::string& tag_name = getItemTagName(*old_childs[old_num]);
+        std::size_t pair_num = new_num;
+        while (pair_num < new_end_num && (new_matched[pair_num - begin_num]
+               || new_tree.getItemTagName(*new_childs[pair_num]) != tag_name))
+            pair_num++;
+        if (pair_num == new_end_num)
+        {
+            TreeDifference difference = { TreeDifference::REMOVED, old_childs[old_num], nullptr };
+            differences.push_back(difference);
+            continue;
+        }
+        /* Пропущенные непарные узлы - вставлены */
+        for (; new_num < pair_num; new_num++)
+            if (!new_matched[new_num - begin_num])
+            {
+                TreeDifference difference = { TreeDifference::INSERTED, nullptr, new_childs[new_num] };
+                differences.push_back(difference);
+                new_matched[new_num - begin_num] = true;
+            }
+        new_matched[pair_num - begin_num] = true;
+        new_num = pair_num + 1;
+        diffItems(*old_childs[old_num], new_tree, *new_childs[pair_num], differences);
+    }
+    for (; new_num < new_end_num; new_num++)
+        if (!new_matched[new_num - begin_num])
+        {
+            TreeDifference difference = { TreeDifference::INSERTED, nullptr, new_childs[new_num] };
+            differences.push_back(difference);
+        }
+}
+
+
+// Отделить поддерево:
+ParserTree ParserTree::detachSubtree(const ParserTreeItem& item, ItemSlot* p_slot)
+{
+    ParserTree subtree(source, spliced_sources);
+    if (&item == root_item || !containsItem(item))
+    {
+        subtree.error_description += "Item can't be detached: it is the root or belongs to another tree;\n";
+        return subtree;
+    }
+
+    /* Убираем узел из родителя: меняются только номера следующих дочерних узлов */
+    ParserTreeItem* p_item = const_cast<ParserTreeItem*>(&item);
+    ParserTreeItem* p_parent = p_item->parent;
+    unsigned int child_num = p_item->column;
+    std::vector<ParserTreeItem::TextOrChild>& sequence = p_parent->location_sequence_of_data;
+    for (unsigned int sequence_pos = 0, count_childs = 0; sequence_pos < sequence.size(); sequence_pos++)
+        if (sequence[sequence_pos] == ParserTreeItem::CHILD && count_childs++ == child_num)
+        {
+            sequence.erase(sequence.begin() + sequence_pos);
+            if (p_slot != nullptr)
+            {
+                p_slot->parent = p_parent;
+                p_slot->sequence_pos = sequence_pos;
+            }
+            break;
+        }
+    p_parent->childs.erase(p_parent->childs.begin() + child_num);
+    for (unsigned int num = child_num; num < p_parent->childs.size(); num++)
+        p_parent->childs[num]->column = num;
+    markDirty(*p_parent);
+    invalidateIndices();
+
+    /* Узел - единственный дочерний узел коренного нового дерева */
+    subtree.root_item->addChild(p_item);
+    p_item->parent = subtree.root_item;
+    p_item->column = 0;
+
+    /* Ряды узлов поддерева уменьшаются, известные хэши переносятся в новое дерево.
+     *   Узлы собираются заранее: отложенные узлы, построенные при обходе, получают ряд уже от нового родителя */
+    int row_shift = p_item->row - 1;
+    std::vector<const ParserTreeItem*> subtree_items;
+    for (const ParserTreeItem& subtree_item : preOrder(*p_item))
+        subtree_items.push_back(&subtree_item);
+    for (const ParserTreeItem* p_subtree_item : subtree_items)
+    {
+        const_cast<ParserTreeItem*>(p_subtree_item)->row -= row_shift;
+        unsigned long long hash;
+        if (findKnownHash(*p_subtree_item, hash))
+            subtree.carried_hashes[p_subtree_item] = hash;
+        else
+            subtree.dirty_items.insert(p_subtree_item);
+    }
+    return subtree;
+}
+
+// Вставить поддерево:
+bool ParserTree::spliceSubtree(const ParserTreeItem& parent, unsigned int child_num, ParserTree&& tree)
+{
+    if (&tree == this || tree.root_item == nullptr || !containsItem(parent))
+        return false;
+    ParserTreeItem* p_parent = const_cast<ParserTreeItem*>(&parent);
+    p_parent->materialize();
+    if (child_num > p_parent->childs.size())
+        return false;
+
+    /* Место вставки в последовательности вхождений - сразу перед дочерним узлом child_num */
+    const std::vector<ParserTreeItem::TextOrChild>& sequence = p_parent->location_sequence_of_data;
+    unsigned int sequence_pos = 0;
+    for (unsigned int count_childs = 0; sequence_pos < sequence.size(); sequence_pos++)
+        if (sequence[sequence_pos] == ParserTreeItem::CHILD && count_childs++ == child_num)
+            break;
+
+    insertSubtree(*p_parent, sequence_pos, std::move(tree));
+    return true;
+}
+
+bool ParserTree::spliceSubtree(const ItemSlot& slot, ParserTree&& tree)
+{
+    if (&tree == this || tree.root_item == nullptr || slot.parent == nullptr || !containsItem(*slot.parent))
+        return false;
+    ParserTreeItem* p_parent = const_cast<ParserTreeItem*>(slot.parent);
+    p_parent->materialize();
+    if (slot.sequence_pos > p_parent->location_sequence_of_data.size())
+        return false;
+
+    insertSubtree(*p_parent, slot.sequence_pos, std::move(tree));
+    return true;
+}
+
+// Перенести тексты и дочерние узлы коренного узла tree в место sequence_pos узла parent:
+void ParserTree::insertSubtree(ParserTreeItem& parent, unsigned int sequence_pos, ParserTree&& tree)
+{
+    /* Номера текста и дочернего узла места вставки */
+    ParserTreeItem* p_root = tree.root_item;
+    std::vector<ParserTreeItem::TextOrChild>& sequence = parent.location_sequence_of_data;
+    unsigned int text_num = 0, child_num = 0;
+    for (unsigned int pos = 0; pos < sequence_pos; pos++)
+        if (sequence[pos] == ParserTreeItem::TEXT)
+            text_num++;
+        else
+            child_num++;
+
+    /* Ряды вставляемых узлов увеличиваются, их хэши известны по номерам в tree */
+    tree.updateIndices();
+    for (ParserTreeItem* p_child : p_root->childs)
+        for (const ParserTreeItem& inserted_item : preOrder(*p_child))
+        {
+            const_cast<ParserTreeItem&>(inserted_item).row += parent.row;
+            carried_hashes[&inserted_item] = tree.content_hashes[inserted_item.pre_order];
+        }
+    markDirty(parent);
+
+    /* Переносим тексты и дочерние узлы коренного узла tree */
+    sequence.insert(sequence.begin() + sequence_pos, p_root->location_sequence_of_data.begin(), p_root->location_sequence_of_data.end());
+    parent.texts.insert(parent.texts.begin() + text_num, p_root->texts.begin(), p_root->texts.end());
+    parent.childs.insert(parent.childs.begin() + child_num, p_root->childs.begin(), p_root->childs.end());
+    for (unsigned int num = child_num; num < parent.childs.size(); num++)
+    {
+        parent.childs[num]->parent = &parent;
+        parent.childs[num]->column = num;
+    }
+    /* Номера текстов сдвинулись: декодированные тексты строятся заново */
+    parent.clearDecodeCache();
+    p_root->location_sequence_of_data.clear();
+    p_root->texts.clear();
+    p_root->childs.clear();
+
+    /* Исходные данные перенесённых узлов живут, пока живёт текущее дерево */
+    tree.spliced_sources.push_back(tree.source);
+    for (const std::shared_ptr<ParserTreeSource>& spliced_source : tree.spliced_sources)
+        if (spliced_source != source && std::find(spliced_sources.begin(), spliced_sources.end(), spliced_source) == spliced_sources.end())
+            spliced_sources.push_back(spliced_source);
+    tree.deleteItems();
+    tree.source.reset();
+    tree.spliced_sources.clear();
+    tree.invalidateIndices();
+
+    invalidateIndices();
 }
 
-void ParserTreeItem::deleteLastChild()
+// Обновить номера узлов и индексы:
+void ParserTree::updateIndices() const
 {
-    ParserTreeItem* p_item = this->childs.back();
-    ParserTree::ParserTreeItemStack stack;
-
-    /* Удаление дочерних элементов требуемого узла: */
+    if (indices_valid.load(std::memory_order_acquire))
+        return;
+    std::lock_guard<std::mutex> lock(*indices_mutex);
+    if (indices_valid.load(std::memory_order_relaxed))
+        return;
 
-    /* Доходим до крайнего правого нижнего узла,
-        записывая все промежуточные узлы в стек */
-    while(!p_item->childs.empty())
+    /* Нумерация в прямом порядке обхода (ряды и колонны обновляются при detachSubtree() и spliceSubtree()).
+     *   Известные хэши берутся по старым номерам до перенумерации */
+    std::vector<ParserTreeItem*> items;
+    std::vector<unsigned long long> hashes;
+    std::vector<bool> rehash;
+    std::vector<ParserTreeItem*> stack(1, root_item);
+    while (!stack.empty())
     {
-        stack.push(p_item);
-        p_item = p_item->childs.back();
+        ParserTreeItem* p_item = stack.back();
+        stack.pop_back();
+        unsigned long long hash = 0;
+        rehash.push_back(!findKnownHash(*p_item, hash));
+        hashes.push_back(hash);
+        p_item->pre_order = items.size();
+        items.push_back(p_item);
+
+        const std::vector<ParserTreeItem*>& childs = p_item->getChilds();
+        for (unsigned int child_num = childs.size(); child_num-- > 0; )
+            stack.push_back(childs[child_num]);
     }
-    stack.push(p_item);
 
-    /* Последовательно удаляем элементы, двигаясь от правых веток к левым */
-    while(stack.size() != 1)    // На вершине стеканаходится самый правый нижний узел
-    {                           // != 1 иначе p_item = stack.top() (после stack.pop()) мокажет указывать на пустоту
-        /* Удаляем самый правый нижний элемент
-            из памяти, стэка и вектора childs */
-        delete stack.top();
-        stack.pop();
-        p_item = stack.top();
-        p_item->childs.pop_back();
+    /* Границы поддеревьев и хэши содержимого - от листьев к корню (так же, как computeContentHashes()).
+     *   Заново вычисляются только хэши изменённых узлов и их предков */
+    for (unsigned int item_num = items.size(); item_num-- > 0; )
+    {
+        ParserTreeItem* p_item = items[item_num];
+        p_item->subtree_end = p_item->childs.empty() ? item_num + 1 : p_item->childs.back()->subtree_end;
+        if (!rehash[item_num])
+            continue;
 
-        /* Спускаемся на новый самый правый нижний узел. Промежуточные узлы в стеке */
-        while (!p_item->childs.empty())
+        const std::string& tag_name = getItemTagName(*p_item);
+        unsigned long long hash = hashBytes(tag_name.data(), tag_name.size());
+        unsigned int text_num = 0, child_num = 0;
+        for (ParserTreeItem::TextOrChild text_or_child : p_item->location_sequence_of_data)
         {
-            p_item = p_item->childs.back();
-            stack.push(p_item);
+            if (text_or_child == ParserTreeItem::TEXT)
+            {
+                const std::string& text = *p_item->texts[text_num++];
+                hash = combineHash(hash, hashBytes(text.data(), text.size()));
+            }
+            else
+                hash = combineHash(hash, hashes[p_item->childs[child_num++]->pre_order]);
         }
+        hashes[item_num] = hash;
+        if (p_item->parent != nullptr)
+            rehash[p_item->parent->pre_order] = true;
     }
-
-    /* Удаление требуемого узла: */
-    delete stack.top();
-    stack.pop();
-    if (this->location_sequence_of_data.back() == TEXT)
+    content_hashes.swap(hashes);
+    dirty_items.clear();
+    carried_hashes.clear();
+
+    /* Индекс ключей: ключи узлов вставленных поддеревьев ищутся в множестве ключей дерева по имени тега
+     *   (один раз на ключ исходных данных поддерева) */
+    tag_index.assign(source->keys.size(), std::vector<unsigned int>());
+    std::unordered_map<const ParserTreeSource*, std::vector<TagId>> spliced_tag_ids;
+    for (unsigned int item_num = 1; item_num < items.size(); item_num++)
     {
-        this->location_sequence_of_data.pop_back();
-        this->location_sequence_of_data.back() = TEXT;
+        const ParserTreeItem* p_item = items[item_num];
+        TagId tag_id = p_item->getTagId();
+        if (p_item->source != source.get())
+        {
+            std::vector<TagId>& tag_ids = spliced_tag_ids[p_item->source];
+            if (tag_ids.empty())
+                tag_ids.assign(p_item->source->keys.size(), TagId(KeySet::ROOT_TAG_ID));
+            if (tag_ids[tag_id] == KeySet::ROOT_TAG_ID)
+                tag_ids[tag_id] = source->keys.findTagId(getItemTagName(*p_item));
+            tag_id = tag_ids[tag_id];
+        }
+        if (tag_id < tag_index.size())
+            tag_index[tag_id].push_back(item_num);
     }
-    else
-        this->location_sequence_of_data.pop_back();
-    this->childs.pop_back();
-}
-
-
-//==========================================================
 
-/* === ParserTree === */
+    indices_valid.store(true, std::memory_order_release);
+}
 
-// Конструктор:
-ParserTree::ParserTree(const std::string& text)
-    : rude_text(text), root_item(new ParserTreeItem(KeyType(""), 0, 0)), error_description()
+// Известный хэш содержимого узла (до updateIndices()):
+// Изменённые узлы хэша не имеют, перенесённые из другого дерева - в carried_hashes, остальные - по старому номеру
+bool ParserTree::findKnownHash(const ParserTreeItem& item, unsigned long long& hash) const
 {
-    /* Проверка на пустую строку */
-    if (rude_text.empty())
-        error_description += "Input text is empty;\n";
-
-    /* Считываем список ключей с файла */
-    std::ifstream fin(Key_list_filename);
-    if (!fin.is_open())
+    if (dirty_items.count(&item) != 0)
+        return false;
+    std::unordered_map<const ParserTreeItem*, unsigned long long>::const_iterator it = carried_hashes.find(&item);
+    if (it != carried_hashes.end())
     {
-        error_description += "File with tag list can't be opened;\n";
-        return;
+        hash = it->second;
+        return true;
     }
-    readKeysFromFile(fin);
-    fin.close();
-
-    /* Находим все позиции ключей, результат в векторе key_positions */
-    bool saccess;
-    saccess = findAllKeyPosition(rude_text);
-    if (saccess == false)
-        error_description += "Input text can't be parsing to tree;\n";
+    if (item.pre_order >= content_hashes.size())
+        return false;
+    hash = content_hashes[item.pre_order];
+    return true;
+}
 
-    /* Если необходимо - сортируем ключи в порядки появления в тексте */
-    auto sort_compare = [](KeyPositionType a, KeyPositionType b)
-    {
-        return a.getBeginKeyAreaPosition() < b.getBeginKeyAreaPosition();
-    };
-    if (saccess == true && !std::is_sorted(key_positions.cbegin(), key_positions.cend(), sort_compare))
-        std::sort(key_positions.begin(), key_positions.end(), sort_compare);
+// Отметить узел и его предков как изменённые:
+void ParserTree::markDirty(const ParserTreeItem& item)
+{
+    for (const ParserTreeItem* p_item = &item; p_item != nullptr && dirty_items.insert(p_item).second; p_item = p_item->parent)
+        ;
 }
 
 
-// Создать дерево:
-// TODO: Описать ошибки (строка, которую не обработать)
-bool ParserTree::createTree()
+// Считать список ключей с файла:
+bool ParserTree::readKeysFromFile(std::ifstream& fin)
 {
-    /* Проверка на ошибки, созданные в конструкторе */
-    if (error_description.empty() == false)
-        return false;
+    return source->keys.readFromFile(fin);
+}
 
-    /* Создаем дерево рекурсивной функцией SubTree */
-    try
-    {
-        unsigned int vector_position = 0;
-        SubTree(0, rude_text.size(), vector_position, *root_item);
-    }
-    catch (std::bad_alloc)
+
+// Вспомоготельные функции:
+// Память местоположений ключей, индексов и хэшей:
+std::size_t ParserTree::keyPositionsBytes() const
+{
+    std::size_t bytes = source->key_positions.capacity() * sizeof(KeyPositionType)
+            + source->subtree_ends.capacity() * sizeof(unsigned int)
+            + content_hashes.capacity() * sizeof(unsigned long long)
+            + tag_index.capacity() * sizeof(std::vector<unsigned int>);
     {
-        error_description += "Not enough memory;\n";
-        return false;
+        std::lock_guard<std::mutex> lock(*indices_mutex);   // Индекс слов может строиться в другом потоке
+        bytes += text_index.getBytes();
     }
+    if (source->line_index_built.load(std::memory_order_acquire))
+        bytes += source->line_starts.capacity() * sizeof(std::size_t);
+    for (const std::vector<unsigned int>& items : tag_index)
+        bytes += items.capacity() * sizeof(unsigned int);
+    return bytes;
+}
 
-    return true;
+// Позиция в тексте со строкой и колонкой (для сообщений об ошибках):
+std::string ParserTree::describePosition(std::size_t offset) const
+{
+    LineColumn line_column = lineColumn(offset);
+    return std::to_string(offset) + ", line " + std::to_string(line_column.line)
+            + ", column " + std::to_string(line_column.column);
 }
 
+// Превышен ли бюджет памяти:
+bool ParserTree::isMemoryBudgetExceeded(std::size_t bytes) const
+{
+    return source->options.memory_budget != 0 && bytes > source->options.memory_budget;
+}
 
-// Деструктор:
-ParserTree::~ParserTree()
+// Удалить все узлы:
+void ParserTree::deleteItems()
 {
-    while (root_item->getChilds().empty() == false)
+    if (root_item == nullptr)       // Перемещённое дерево
+        return;
+    while (root_item->childs.empty() == false)
         root_item->deleteLastChild();
     delete root_item;
+    root_item = nullptr;
 }
 
+// Освободить недостроенное дерево:
+void ParserTree::releaseTree()
+{
+    source->items_memory_limit = 0;
+    source->build_control = nullptr;
+    deleteItems();
+    root_item = new ParserTreeItem(KeySet::ROOT_TAG_ID, ParserTreeItem::ROOT_KEY_POSITION_NUM, 0, 0);
+    root_item->source = source.get();
+    source->items_bytes = sizeof(ParserTreeItem);
+    source->text_pool = TextPool();
+    tag_index.clear();
+    content_hashes.clear();
+    dirty_items.clear();
+    carried_hashes.clear();
+    text_index.clear();
+    text_index_valid = false;
+    items_match_source = false;
+    source->subtree_ends.clear();
+}
 
-// Поиск данных по ключу:
-// TODO: ParserTree::find()
-ParserTree& ParserTree::find(const KeyType& key)
+// Имя тега узла (в множестве ключей исходных данных узла):
+const std::string& ParserTree::getItemTagName(const ParserTreeItem& item) const
 {
-    if (key.getName() != "")
-        return *this;
-    return *this;
+    return item.source->keys.getTagName(item.getTagId());
+}
+
+// Принадлежит ли узел дереву:
+bool ParserTree::containsItem(const ParserTreeItem& item) const
+{
+    const ParserTreeItem* p_item = &item;
+    while (p_item->parent != nullptr)
+        p_item = p_item->parent;
+    return p_item == root_item;
 }
 
+// Пометить номера узлов и индексы устаревшими:
+void ParserTree::invalidateIndices()
+{
+    indices_valid = false;
+    text_index_valid = false;
+    items_match_source = false;
+    last_find.clear();
+}
 
-// Вспомоготельные функции:
-// Создаем поддерево (рекурсивно):
-void ParserTree::SubTree(unsigned int begin_rude_text_pos, unsigned int end_rude_text_pos,
-                           unsigned int& vector_pos, ParserTreeItem& item)
+
+// Найти границы поддеревьев местоположений ключей:
+void ParserTree::findSubtreeEnds()
 {
-    static std::stack<unsigned int, std::vector<unsigned int>> vector_pos_stack;
-    unsigned int text_pos = begin_rude_text_pos;        // position in rude_text
-                                                 // vector_pos = (max - 1) number used key position in key_positions
-    while (text_pos != end_rude_text_pos)
+    const std::vector<KeyPositionType>& key_positions = source->key_positions;
+    std::vector<unsigned int>& subtree_ends = source->subtree_ends;
+    subtree_ends.assign(key_positions.size(), key_positions.size());
+
+    /* Ключи, данные которых ещё не закончились (так же вкладывает узлы SubTree()).
+     *   При перекрывающихся тегах (<b><i></b></i>) ключ может начинаться после конца данных предыдущего
+     *   брата, но до конца его зоны действия - он не вкладывается в брата */
+    std::vector<unsigned int> open_positions;
+    for (unsigned int vector_pos = 0; vector_pos < key_positions.size(); vector_pos++)
     {
-        /* Add new item */
-        if (vector_pos < key_positions.size() && text_pos == key_positions[vector_pos].getBeginKeyAreaPosition())
+        while (!open_positions.empty() && key_positions[open_positions.back()].getEndDataPosition()
+                                          <= key_positions[vector_pos].getBeginKeyAreaPosition())
         {
-            ParserTreeItem * p_child = new ParserTreeItem(
-                        KeyType(rude_text.substr(text_pos, key_positions[vector_pos].getBeginDataPosition() - text_pos)), item.getRow() + 1, item.getChilds().size());
-            item.addChild(p_child);
-            vector_pos_stack.push(vector_pos);
-            vector_pos++;
-            SubTree(key_positions[vector_pos - 1].getBeginDataPosition(), key_positions[vector_pos - 1].getEndDataPosition(), vector_pos, *p_child);
-            text_pos = key_positions[vector_pos_stack.top()].getEndKeyAreaPosition();
-            vector_pos_stack.pop();
+            subtree_ends[open_positions.back()] = vector_pos;
+            open_positions.pop_back();
+        }
+        open_positions.push_back(vector_pos);
+    }
+}
+
+
+// Вычислить хэши содержимого всех узлов (от листьев к корню):
+void ParserTree::computeContentHashes()
+{
+    const std::vector<KeyPositionType>& key_positions = source->key_positions;
+    const std::vector<unsigned int>& subtree_ends = source->subtree_ends;
+    const std::string& rude_text = source->rude_text;
+    const KeySet& keys = source->keys;
+    const ParseOptions& options = source->options;
+
+    /* Хэши имён тегов (не идентификаторов: у сравниваемых деревьев могут быть разные множества ключей) */
+    std::vector<unsigned long long> tag_hashes(keys.size());
+    for (TagId tag_id = 0; tag_id < keys.size(); tag_id++)
+        tag_hashes[tag_id] = hashBytes(keys.getTagName(tag_id).data(), keys.getTagName(tag_id).size());
+
+    /* Хэш текстового отрывка - так же, как его сохранит storeText() */
+    auto text_hash = [&rude_text, &options](std::size_t begin_pos, std::size_t end_pos, unsigned long long& hash)
+    {
+        /* Зона действия дочернего ключа может заканчиваться после конца данных (перекрывающиеся теги) */
+        if (begin_pos >= end_pos)
+            return;
+        const char* data = rude_text.data() + begin_pos;
+        std::size_t size = end_pos - begin_pos;
+        if (options.whitespace_mode != KEEP_WHITESPACE && isWhitespaceText(data, size))
+        {
+            if (options.whitespace_mode == DROP_WHITESPACE)
+                return;
+            const char* collapsed = containsByte(data, size, '\n') ? "\n" : " ";
+            hash = combineHash(hash, hashBytes(collapsed, 1));
+        }
+        else
+            hash = combineHash(hash, hashBytes(data, size));
+    };
+
+    /* Хэш узла: имя тега, затем тексты и хэши дочерних узлов в порядке следования.
+     *   Дочерние местоположения имеют большие номера, поэтому идём с конца */
+    content_hashes.assign(key_positions.size() + 1, 0);
+    for (unsigned int pre_order = key_positions.size() + 1; pre_order-- > 0; )
+    {
+        std::size_t begin_pos, end_pos;
+        unsigned int child_pos = pre_order, end_child_pos;
+        unsigned long long hash;
+        if (pre_order == 0)
+        {
+            begin_pos = 0;
+            end_pos = rude_text.size();
+            end_child_pos = key_positions.size();
+            hash = tag_hashes[KeySet::ROOT_TAG_ID];
         }
-        /* Add new text */
         else
         {
-            unsigned int end_temp_pos;
-            if (vector_pos < key_positions.size() && key_positions[vector_pos].getBeginKeyAreaPosition() < end_rude_text_pos)
-                end_temp_pos = key_positions[vector_pos].getBeginKeyAreaPosition();
-            else
-                end_temp_pos = end_rude_text_pos;
-            item.addText(rude_text.substr(text_pos, end_temp_pos - text_pos));
-            text_pos = end_temp_pos;
+            const KeyPositionType& key_position = key_positions[pre_order - 1];
+            begin_pos = key_position.getBeginDataPosition();
+            end_pos = key_position.getEndDataPosition();
+            end_child_pos = subtree_ends[pre_order - 1];
+            hash = tag_hashes[key_position.getTagId()];
         }
+
+        while (child_pos < end_child_pos)
+        {
+            const KeyPositionType& child_position = key_positions[child_pos];
+            text_hash(begin_pos, child_position.getBeginKeyAreaPosition(), hash);
+            hash = combineHash(hash, content_hashes[child_pos + 1]);
+            begin_pos = std::max(begin_pos, child_position.getEndKeyAreaPosition());
+            child_pos = subtree_ends[child_pos];
+        }
+        text_hash(begin_pos, end_pos, hash);
+        content_hashes[pre_order] = hash;
     }
 }
 
 
-// Считать список ключей с файла:
-bool ParserTree::readKeysFromFile(std::ifstream& fin)
+// Построить индекс слов, если он ещё не построен (потокобезопасно):
+bool ParserTree::buildTextIndex() const
 {
-    const std::string empty_element[] = {
-        "area", "base", "br", "col", "command", "embed", "hr", "img",
-        "input", "keygen", "link", "meta", "param", "source", "track", "wbr"
-    };
-    const std::string * p_str_begin = empty_element;
-    const std::string * p_str_end = empty_element + sizeof(empty_element) / sizeof(*empty_element);
+    updateIndices();
+    if (text_index_valid.load(std::memory_order_acquire))
+        return true;
+    bool built;
+    std::size_t growth_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(*indices_mutex);
+        if (text_index_valid.load(std::memory_order_relaxed))
+            return true;
+        std::size_t old_bytes = text_index.getBytes();
+        if (items_match_source)
+            built = indexSourceTexts();     // Индекс не строился при разборе: узлы отложенного дерева не нужны
+        else
+            built = indexItemTexts();       // Дерево изменено
+        if (text_index.getBytes() > old_bytes)
+            growth_bytes = text_index.getBytes() - old_bytes;
+    }
+    source->reportGrowth(growth_bytes);
+    return built;
+}
 
-    /* Проверка на успешность открытия файла */
-    if (!fin.is_open())
-        return false;
+// Построить индекс слов по местоположениям ключей (узлы не нужны):
+bool ParserTree::indexSourceTexts() const
+{
+    const std::vector<KeyPositionType>& key_positions = source->key_positions;
+    const std::vector<unsigned int>& subtree_ends = source->subtree_ends;
+    const std::string& rude_text = source->rude_text;
 
-    /* Считывание строк с файла */
-    std::string cur_str;
-    std::getline(fin, cur_str);
-    while (fin)
+    /* Собственные тексты узла - отрезки данных между дочерними ключами (так же, как в computeContentHashes()) */
+    text_index.clear();
+    for (unsigned int pre_order = 0; pre_order <= key_positions.size(); pre_order++)
     {
-        cur_str += '\n';       // Восстановление исходной строки (как в файле)
-        /* Пропускаем строки, начинающиеся с '#' */
-        if (cur_str[0] == '#')
+        std::size_t begin_pos, end_pos;
+        unsigned int child_pos = pre_order, end_child_pos;
+        if (pre_order == 0)
         {
-            std::getline(fin, cur_str);
-            continue;
+            begin_pos = 0;
+            end_pos = rude_text.size();
+            end_child_pos = key_positions.size();
         }
-        /* Пропускаем пустые строки */
-        if (cur_str.find_first_not_of(" \t\n") == std::string::npos)
+        else
         {
-            std::getline(fin, cur_str);
-            continue;
+            begin_pos = key_positions[pre_order - 1].getBeginDataPosition();
+            end_pos = key_positions[pre_order - 1].getEndDataPosition();
+            end_child_pos = subtree_ends[pre_order - 1];
         }
 
-        /* Устанавливаем ключи */
-        unsigned int  begin_key_word = cur_str.find_first_not_of(" \t\n");
-        unsigned int end_key_word;
-        std::string key_word;
-        while ( begin_key_word < cur_str.size())
+        /* Зона действия дочернего ключа может заканчиваться после конца данных (перекрывающиеся теги) */
+        unsigned int word_num = 0;
+        while (child_pos < end_child_pos)
         {
-            end_key_word = cur_str.find_first_of(" \t\n",  begin_key_word);
-            key_word = std::move(cur_str.substr( begin_key_word, end_key_word -  begin_key_word));
-            if (std::find(p_str_begin, p_str_end, key_word) != p_str_end)
-                keys.insert(KeyType("<" + key_word + ">"));
-            else
-                keys.insert(KeyType("<" + key_word + "> </" + key_word + ">"));
-            begin_key_word = cur_str.find_first_not_of(" \t\n", end_key_word + 1);
+            const KeyPositionType& child_position = key_positions[child_pos];
+            if (begin_pos < child_position.getBeginKeyAreaPosition()
+                && !text_index.addText(pre_order, rude_text.data() + begin_pos, child_position.getBeginKeyAreaPosition() - begin_pos, word_num))
+            {
+                text_index.clear();
+                return false;
+            }
+            begin_pos = std::max(begin_pos, child_position.getEndKeyAreaPosition());
+            child_pos = subtree_ends[child_pos];
+        }
+        if (begin_pos < end_pos && !text_index.addText(pre_order, rude_text.data() + begin_pos, end_pos - begin_pos, word_num))
+        {
+            text_index.clear();
+            return false;
         }
-
-        /* Считываем следующую строку */
-        std::getline(fin, cur_str);
     }
+    text_index_valid.store(true, std::memory_order_release);
+    return true;
+}
 
+// Построить индекс слов по текстам узлов (после detachSubtree() и spliceSubtree()):
+bool ParserTree::indexItemTexts() const
+{
+    text_index.clear();
+    for (const ParserTreeItem& item : preOrder(*root_item))
+    {
+        unsigned int word_num = 0;
+        for (const std::string* p_text : item.getTexts())
+            if (!text_index.addText(item.getPreOrder(), p_text->data(), p_text->size(), word_num))
+            {
+                text_index.clear();
+                return false;
+            }
+    }
+    text_index_valid.store(true, std::memory_order_release);
     return true;
 }
 
 
+// Найти и отсортировать местоположения ключей:
+void ParserTree::parseText()
+{
+    /* Индекс строк - за один проход перед поиском ключей */
+    if (source->options.line_index)
+        source->buildLineIndex();
+
+    /* Находим все позиции ключей, результат в векторе key_positions */
+    std::vector<KeyPositionType>& key_positions = source->key_positions;
+    bool saccess;
+    saccess = findAllKeyPosition(source->rude_text);
+    if (saccess == false)
+        error_description += "Input text can't be parsing to tree;\n";
+
+    /* Если необходимо - сортируем ключи в порядки появления в тексте */
+    auto sort_compare = [](const KeyPositionType& a, const KeyPositionType& b)
+    {
+        return a.getBeginKeyAreaPosition() < b.getBeginKeyAreaPosition();
+    };
+    if (saccess == true && !std::is_sorted(key_positions.cbegin(), key_positions.cend(), sort_compare))
+        std::sort(key_positions.begin(), key_positions.end(), sort_compare);
+}
+
+
 /* Set key_positions (all possible positions); Protected */
 // NOTE: May be optimized
 bool ParserTree::findAllKeyPosition(const std::string& s)
 {
-    unsigned int begin_key_area_pos, end_key_area_pos;  // [...)
-    unsigned int begin_data_pos, end_data_pos;          // [...)
-    unsigned int find_current_pos, find_end_pos;
+    std::vector<KeyPositionType>& key_positions = source->key_positions;
+    const KeySet& keys = source->keys;
+    const ParseOptions& options = source->options;
+    std::size_t begin_key_area_pos, end_key_area_pos;   // [...)
+    std::size_t begin_data_pos, end_data_pos;           // [...)
+    std::size_t find_current_pos, find_end_pos;
+
+    /* Позиции ключей хранятся в KeyPositionType не более чем в 36 битах */
+    if (static_cast<unsigned long long>(s.size()) > KeyPositionType::MAX_POSITION)
+    {
+        error_description += "Input text is too large (" + std::to_string(s.size()) + " bytes, limit "
+                + std::to_string(KeyPositionType::MAX_POSITION) + ");\n";
+        return false;
+    }
 
     /* Для каждого ключа проходим по всей строке, выискивая его позиции.
      *   при успешном нахождении ключа ищем все остальные его точки и запоминаем их,
      *   затем продолжаем поиск с начала данных последнего ключа */
     find_current_pos = 0;
     find_end_pos = s.size();
-    for (KeyType current_key : keys)
+    ParseControl* control = options.control;
+    if (control != nullptr)
+        control->setBytesTotal(s.size() * keys.size());     // Поиск каждого ключа, кроме корневого, и построение дерева
+    for (TagId tag_id = 0; tag_id < keys.size(); tag_id++)
     {
+        if (tag_id == KeySet::ROOT_TAG_ID)
+            continue;
+        if (keys.findTagId(keys.getTagName(tag_id)) != tag_id)
+            continue;       // Имя тега совпадает с более ранним ключом без учёта регистра
+        const KeyType& current_key = keys.getKey(tag_id);
         while (find_current_pos != find_end_pos)
         {
+            if (control != nullptr)
+            {
+                if (control->isCancelled())
+                {
+                    error_description += "Parsing cancelled;\n";
+                    return false;
+                }
+                control->setBytesScanned(s.size() * (tag_id - 1) + find_current_pos);
+            }
             begin_key_area_pos = current_key.getFindBeginKeyAreaPosition()(s, find_current_pos, current_key.getName(), *this);
             if (begin_key_area_pos == std::string::npos)
                 break;
@@ -305,7 +1701,7 @@ bool ParserTree::findAllKeyPosition(const std::string& s)
             if (begin_data_pos == std::string::npos)
             {
                 error_description += "Can't find begin data position by " + current_key.getName() + "\n";
-                error_description += "    search start from " + std::to_string(begin_key_area_pos) + " (";
+                error_description += "    search start from " + describePosition(begin_key_area_pos) + " (";
                 error_description += s.substr(begin_key_area_pos, 20) + "...)\n";
                 return false;
             }
@@ -314,7 +1710,7 @@ bool ParserTree::findAllKeyPosition(const std::string& s)
             if (end_data_pos == std::string::npos)
             {
                 error_description += "Can't find end data position by " + current_key.getName() + "\n";
-                error_description += "    search start from " + std::to_string(begin_data_pos) + " (";
+                error_description += "    search start from " + describePosition(begin_data_pos) + " (";
                 error_description += s.substr(begin_data_pos, 20) + "...)\n";
                 return false;
             }
@@ -323,12 +1719,37 @@ bool ParserTree::findAllKeyPosition(const std::string& s)
             if (end_key_area_pos == std::string::npos)
             {
                 error_description += "Can't find end key area position by " + current_key.getName() + "\n";
-                error_description += "    search start from " + std::to_string(end_data_pos) + " (";
+                error_description += "    search start from " + describePosition(end_data_pos) + " (";
                 error_description += s.substr(end_data_pos, 20) + "...)\n";
                 return false;
             }
 
-            key_positions.push_back(KeyPositionType(current_key, begin_key_area_pos, end_key_area_pos,
+            /* Номера ключей и узлов хранятся 32-битными */
+            if (key_positions.size() >= MAX_KEY_POSITIONS)
+            {
+                error_description += "Too many keys (limit " + std::to_string(MAX_KEY_POSITIONS) + ");\n";
+                std::vector<KeyPositionType>().swap(key_positions);
+                return false;
+            }
+            /* Буфер вектора растёт вдвое, но не сверх бюджета памяти: учитывается выделенная ёмкость, а не число ключей */
+            if (key_positions.size() == key_positions.capacity())
+            {
+                std::size_t new_capacity = std::max<std::size_t>(key_positions.capacity() * 2, 64);
+                if (options.memory_budget != 0)
+                {
+                    std::size_t free_bytes = options.memory_budget > s.capacity() ? options.memory_budget - s.capacity() : 0;
+                    new_capacity = std::min(new_capacity, free_bytes / sizeof(KeyPositionType));
+                }
+                if (new_capacity <= key_positions.size())
+                {
+                    error_description += "Memory budget exceeded (" + std::to_string(options.memory_budget) + " bytes) by "
+                            + std::to_string(key_positions.size()) + " key positions;\n";
+                    std::vector<KeyPositionType>().swap(key_positions);
+                    return false;
+                }
+                key_positions.reserve(new_capacity);
+            }
+            key_positions.push_back(KeyPositionType(tag_id, begin_key_area_pos, end_key_area_pos,
                                                    begin_data_pos, end_data_pos));
             find_current_pos = begin_data_pos;
         }
@@ -338,10 +1759,11 @@ bool ParserTree::findAllKeyPosition(const std::string& s)
 }
 
 /* Show methods */
-std::string ParserTree::outASCIITree() const
+std::string ParserTree::outASCIITree(const ParseControl* control) const
 {
-    if (rude_text.empty())
+    if (source->rude_text.empty())
         return "";
+    updateIndices();     // Ряды узлов после detachSubtree() и spliceSubtree()
 
     struct ItemOutputState
     {
@@ -368,7 +1790,9 @@ std::string ParserTree::outASCIITree() const
         /* New key area */
         if (p_state->location_sequence_num == 0)
         {
-            writeWithIndention(output, indent, p_item->getRow(), std::string("@" + p_item->getKey().getName() + "\n"));
+            if (control != nullptr && control->isCancelled())
+                return "";
+            writeWithIndention(output, indent, p_item->getRow(), std::string("@" + getItemKeyText(*p_item) + "\n"));
             writeWithIndention(output, indent, p_item->getRow(), "//====================\n");
         }
 
@@ -392,8 +1816,8 @@ std::string ParserTree::outASCIITree() const
         {
             if (p_item->getLocationSequenceOfData()[p_state->location_sequence_num] == ParserTreeItem::TEXT)
             {
-                writeWithIndention(output, indent, p_item->getRow() + 1, "[" + p_item->getTexts()[p_state->text_num]);
-                if (p_item->getTexts()[p_state->text_num].back() == '\n')
+                writeWithIndention(output, indent, p_item->getRow() + 1, "[" + *p_item->getTexts()[p_state->text_num]);
+                if (p_item->getTexts()[p_state->text_num]->back() == '\n')
                     writeWithIndention(output, indent, p_item->getRow() + 1, "]\n");
                 else
                     output += "]\n";
@@ -417,19 +1841,146 @@ std::string ParserTree::outASCIITree() const
 }
 
 
+// Декодированный текст поддерева:
+std::string ParserTree::decodedText(const ParserTreeItem& subtree) const
+{
+    typedef std::pair<const ParserTreeItem*, unsigned int> ItemAndSequenceNum;
+    std::vector<ItemAndSequenceNum> stack;
+    std::vector<const std::string*> decoded_parts;
+
+    /* Собираем декодированные отрывки в порядке следования в тексте */
+    stack.push_back(ItemAndSequenceNum(&subtree, 0));
+    while (!stack.empty())
+    {
+        const ParserTreeItem* p_item = stack.back().first;
+        unsigned int sequence_num = stack.back().second;
+        stack.pop_back();
+
+        unsigned int text_num = 0, child_num = 0;
+        for (unsigned int i = 0; i < sequence_num; i++)
+            (p_item->getLocationSequenceOfData()[i] == ParserTreeItem::TEXT ? text_num : child_num)++;
+
+        for (; sequence_num < p_item->getLocationSequenceOfData().size(); sequence_num++)
+        {
+            if (p_item->getLocationSequenceOfData()[sequence_num] == ParserTreeItem::TEXT)
+                decoded_parts.push_back(&p_item->getDecodedText(text_num++));
+            else
+            {
+                /* Продолжим с этого места после обхода дочернего узла */
+                stack.push_back(ItemAndSequenceNum(p_item, sequence_num + 1));
+                stack.push_back(ItemAndSequenceNum(p_item->getChilds()[child_num], 0));
+                break;
+            }
+        }
+    }
+
+    /* Объединяем с однократным выделением памяти */
+    std::string::size_type total_size = 0;
+    for (const std::string* p_part : decoded_parts)
+        total_size += p_part->size();
+    std::string output;
+    output.reserve(total_size);
+    for (const std::string* p_part : decoded_parts)
+        output += *p_part;
+
+    return output;
+}
+
+
+// Ключ узла:
+const KeyType& ParserTree::getKey(const ParserTreeItem& item) const
+{
+    return item.source->keys.getKey(item.getTagId());
+}
+
+// Текст ключа узла:
+std::string ParserTree::getItemKeyText(const ParserTreeItem& item) const
+{
+    if (item.getKeyPositionNum() == ParserTreeItem::ROOT_KEY_POSITION_NUM)
+        return "";
+    const KeyPositionType& key_position = item.source->key_positions[item.getKeyPositionNum()];
+    return item.source->rude_text.substr(key_position.getBeginKeyAreaPosition(),
+                                         key_position.getBeginDataPosition() - key_position.getBeginKeyAreaPosition());
+}
+
+// Строка и колонка позиции:
+ParserTree::LineColumn ParserTree::lineColumn(std::size_t offset) const
+{
+    return source->lineColumn(offset);
+}
+
+// Строка и колонка узла:
+ParserTree::LineColumn ParserTree::getItemLineColumn(const ParserTreeItem& item) const
+{
+    if (item.getKeyPositionNum() == ParserTreeItem::ROOT_KEY_POSITION_NUM)
+        return item.source->lineColumn(0);
+    return item.source->lineColumn(item.source->key_positions[item.getKeyPositionNum()].getBeginKeyAreaPosition());
+}
+
+
 // Чтение полей класса:
-const std::string& ParserTree::getRudeText() const              { return rude_text; }
+const std::string& ParserTree::getRudeText() const              { return source->rude_text; }
+const ParserTreeItem& ParserTree::getRootItem() const           { return *root_item; }
 const std::string& ParserTree::getErrorDescription() const      { return error_description; }
+const ParserTree::ParseOptions& ParserTree::getParseOptions() const { return source->options; }
+const TextPool& ParserTree::getTextPool() const                 { return source->text_pool; }
+const KeySet& ParserTree::getKeySet() const                     { return source->keys; }
+const std::vector<KeyPositionType>& ParserTree::getKeyPositions() const { return source->key_positions; }
+
+ParserTree::MemoryUsage ParserTree::getMemoryUsage() const
+{
+    MemoryUsage usage;
+    usage.source_text = source->rude_text.capacity();
+    usage.key_positions = keyPositionsBytes();
+    {
+        std::lock_guard<std::mutex> lock(source->lazy_mutex);   // Отложенные узлы могут строиться в других потоках
+        usage.items = source->items_bytes;
+        usage.texts = source->text_pool.getBytes();
+    }
+
+    /* Исходные данные вставленных поддеревьев */
+    for (const std::shared_ptr<ParserTreeSource>& spliced_source : spliced_sources)
+    {
+        usage.source_text += spliced_source->rude_text.capacity();
+        usage.key_positions += spliced_source->key_positions.capacity() * sizeof(KeyPositionType)
+                + spliced_source->subtree_ends.capacity() * sizeof(unsigned int);
+        std::lock_guard<std::mutex> lock(spliced_source->lazy_mutex);
+        usage.items += spliced_source->items_bytes;
+        usage.texts += spliced_source->text_pool.getBytes();
+    }
+    usage.total = usage.source_text + usage.key_positions + usage.items + usage.texts;
+    return usage;
+}
+
+// Обработчик роста памяти:
+void ParserTree::setMemoryGrowthCallback(std::function<void(std::size_t)> callback)
+{
+    source->growth_callback = std::move(callback);
+}
 
 
 //=======================================================
 
 /* === Other funtion === */
+bool isWhitespaceText(const char* data, std::size_t size)
+{
+    for (std::size_t pos = 0; pos < size; pos++)
+        if (data[pos] != ' ' && data[pos] != '\t' && data[pos] != '\r' && data[pos] != '\n' && data[pos] != '\f')
+            return false;
+    return true;
+}
+
+unsigned long long combineHash(unsigned long long hash, unsigned long long value)
+{
+    hash ^= value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
 // TODO: Заменить поледний for на std::copy
 void writeWithIndention(std::string &output, const std::string& indent, int count_indent, const std::string& s)
 {
-    unsigned int last_pos = -1;
-    unsigned int prev_pos;
+    std::size_t last_pos = std::string::npos;
+    std::size_t prev_pos;
     while (last_pos + 1 < s.size())      // write line by line
     {
         prev_pos = last_pos + 1;         // eat '\n'
@@ -439,7 +1990,7 @@ void writeWithIndention(std::string &output, const std::string& indent, int coun
 
         for (int i = 0; i < count_indent; i++)
             output += indent;
-        for (unsigned int pos = prev_pos; pos <= last_pos; pos++)
+        for (std::size_t pos = prev_pos; pos <= last_pos; pos++)
             output += s[pos];
     }
 }
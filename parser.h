@@ -6,14 +6,23 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
 #include <stack>
 #include <algorithm>
 #include <iterator>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
 
 /// Имя файла со списком ключей
 const std::string Key_list_filename = "C:\\Users\\Admin\\Desktop\\parser_test\\tag list.txt";
 
 class ParserTree;
+class ParserTreeSource;
 
 
 /// Ключ
@@ -21,7 +30,7 @@ class KeyType {
 public:
     // Новые типы данных:
     /// Тип функции для поиска позиции
-    typedef unsigned int (*FindPositionFunctionType)(const std::string& s, unsigned int begin_position, const std::string& key_name, const ParserTree& tree);
+    typedef std::size_t (*FindPositionFunctionType)(const std::string& s, std::size_t begin_position, const std::string& key_name, const ParserTree& tree);
 
     /// Функции поиска позиций
     struct SearchPositionFunctions {
@@ -30,33 +39,33 @@ public:
          * @param [in] s - строка, в которой выполняется поиск
          * @param [in] begin_pos - позиция, с которой начинается поиск
          * @param [in] tree - дерево, которое вызывает функцию
-         * @return позиция начала ключевой области в строке
+         * @return позиция начала ключевой области в строке или std::string::npos
          */
-        unsigned int (*find_begin_key_area_position)(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree);
+        std::size_t (*find_begin_key_area_position)(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree);
 
         /** Поиск начала данных ключа
          * @param [in] s - строка, в которой выполняется поиск
          * @param [in] begin_key_area_pos - позиция, с которой начинается поиск
          * @param [in] tree - дерево, которое вызывает функцию
-         * @return позиция начала данных ключа в строке
+         * @return позиция начала данных ключа в строке или std::string::npos
          */
-        unsigned int (*find_begin_data_position)(const std::string& s, unsigned int begin_key_area_pos, const std::string& key_name, const ParserTree& tree);
+        std::size_t (*find_begin_data_position)(const std::string& s, std::size_t begin_key_area_pos, const std::string& key_name, const ParserTree& tree);
 
         /** Поиск конца данных ключа
          * @param [in] s - строка, в которой выполняется поиск
          * @param [in] begin_data_pos - позиция, с которой начинается поиск
          * @param [in] tree - дерево, которое вызывает функцию
-         * @return позиция конца данных ключа в строке
+         * @return позиция конца данных ключа в строке или std::string::npos
          */
-        unsigned int (*find_end_data_position)(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree);
+        std::size_t (*find_end_data_position)(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree);
 
         /** Поиск конца ключевой области
          * @param s - строка, в которой выполняется поиск
          * @param end_data_pos - позиция, с которой начинается поиск
          * @param tree - дерево, которое вызывает функцию
-         * @return позиция конца ключевой области в строке
+         * @return позиция конца ключевой области в строке или std::string::npos
          */
-        unsigned int (*find_end_key_area_position)(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree);
+        std::size_t (*find_end_key_area_position)(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree);
     };
 
 private:
@@ -103,7 +112,7 @@ public:
      * @param [in] key - ключ, с которым сравниваем
      * @return результат лексикографического сравнения их имён
      */
-    bool operator<(KeyType key) const               { return name < key.name; }
+    bool operator<(const KeyType& key) const        { return name < key.name; }
 
 
     // Чтение полей класса:
@@ -137,6 +146,190 @@ public:
 const KeyType::SearchPositionFunctions findSearchFunction(const std::string& key_name);
 
 
+/// Идентификатор ключа в множестве ключей KeySet
+typedef unsigned short TagId;
+
+/// Множество ключей с таблицей идентификаторов
+class KeySet {
+public:
+    // Константы:
+    static const TagId ROOT_TAG_ID = 0;         ///< Идентификатор корневого ключа (с пустым именем)
+    static const TagId NO_TAG_ID = 0xFFFF;      ///< Отсутствующий идентификатор
+
+private:
+    // Данные:
+    std::vector<KeyType> keys;                  ///< Ключи, номер в векторе - идентификатор ключа
+    std::vector<std::string> tag_names;         ///< Имена тегов ключей ("div" для ключа "<div> </div>")
+    std::map<std::string, TagId> tag_ids;       ///< Идентификаторы ключей по именам тегов (в нижнем регистре при case_insensitive)
+    unsigned long long id;                      ///< Идентификатор множества (хэш имён ключей)
+    bool case_insensitive;                      ///< Имена тегов сравниваются без учёта регистра ASCII
+
+public:
+    /** Конструктор
+     * @details Множество содержит только корневой ключ ROOT_TAG_ID
+     */
+    KeySet();
+
+    /** Добавление ключа
+     * @param [in] key - ключ
+     * @return идентификатор ключа (уже существующий, если тег с таким именем добавлен ранее)
+     *  или NO_TAG_ID, если таблица идентификаторов переполнена
+     */
+    TagId add(const KeyType& key);
+
+    /** Считывание ключей с файла
+     * @param fin - файл
+     * @return успешность считывания ключей с файла
+     */
+    bool readFromFile(std::ifstream& fin);
+
+    /** Поиск идентификатора по имени тега
+     * @param [in] tag_name - имя тега ("div")
+     * @return идентификатор ключа или NO_TAG_ID
+     */
+    TagId findTagId(const std::string& tag_name) const;
+
+    /** Поиск идентификатора ключа
+     * @param [in] key - ключ ("<div> </div>")
+     * @return идентификатор ключа с тем же именем тега или NO_TAG_ID
+     */
+    TagId findKeyTagId(const KeyType& key) const;
+
+    /** Проверка на пустой элемент
+     * @details Пустой элемент задаётся ключом без конечного тега ("<br>")
+     * @param [in] tag_id - идентификатор ключа
+     * @return является ли ключ пустым элементом
+     */
+    bool isEmptyElement(TagId tag_id) const;
+
+    /** Установка сравнения имён тегов без учёта регистра ASCII
+     * @details Действует на findTagId() и на поиск ключей в тексте: "<DIV>", "<Div>" и "<div>" находятся одним ключом.
+     *  Если имена ранее добавленных ключей совпадают без учёта регистра, остаётся идентификатор первого из них
+     * @param [in] ignore_case - сравнивать без учёта регистра
+     */
+    void setCaseInsensitive(bool ignore_case);
+
+    // Чтение полей класса:
+    /** Чтение ключа
+     * @param [in] tag_id - идентификатор ключа
+     * @return ключ
+     */
+    const KeyType& getKey(TagId tag_id) const           { return keys[tag_id]; }
+
+    /** Чтение имени тега
+     * @param [in] tag_id - идентификатор ключа
+     * @return имя тега
+     */
+    const std::string& getTagName(TagId tag_id) const   { return tag_names[tag_id]; }
+
+    /** Количество ключей (вместе с корневым)
+     * @return количество ключей
+     */
+    std::size_t size() const                            { return keys.size(); }
+
+    /** Чтение признака сравнения без учёта регистра
+     * @return сравниваются ли имена тегов без учёта регистра ASCII
+     */
+    bool isCaseInsensitive() const                      { return case_insensitive; }
+
+    /** Чтение идентификатора множества
+     * @details Зависит только от имён ключей, порядка их добавления и isCaseInsensitive():
+     *  одинаковые множества имеют одинаковые идентификаторы
+     * @return идентификатор множества
+     */
+    unsigned long long getId() const                    { return case_insensitive ? ~id : id; }
+};
+
+
+// Функции обработки текста:
+/** Проверка наличия байта в строке
+ * @details При наличии SSE2 строка проверяется блоками по 16 байт
+ * @param [in] data - начало строки
+ * @param [in] size - длина строки
+ * @param [in] byte - искомый байт
+ * @return содержит ли строка байт
+ */
+bool containsByte(const char* data, std::size_t size, char byte);
+
+/** Поиск начал строк
+ * @details При наличии SSE2 переводы строк ищутся блоками по 16 байт
+ * @param [in] text - текст
+ * @param [out] line_starts - позиции начал строк: 0 и позиции после каждого '\n' (дополняется в конец)
+ */
+void findLineStarts(const std::string& text, std::vector<std::size_t>& line_starts);
+
+/** Сравнение без учёта регистра ASCII
+ * @details При наличии SSE2 байты сравниваются блоками по 16. Байты >= 0x80 сравниваются как есть
+ * @param [in] a - начало первой строки
+ * @param [in] b - начало второй строки
+ * @param [in] size - длина строк
+ * @return равны ли строки без учёта регистра ASCII
+ */
+bool equalsIgnoreAsciiCase(const char* a, const char* b, std::size_t size);
+
+/** Поиск подстроки без учёта регистра ASCII
+ * @details При наличии SSE2 кандидаты отбираются по первому и последнему байтам образца блоками по 16 позиций
+ * @param [in] s - строка, в которой выполняется поиск
+ * @param [in] pattern - искомая подстрока
+ * @param [in] pos - позиция, с которой начинается поиск
+ * @return позиция вхождения или std::string::npos
+ */
+std::string::size_type findIgnoreAsciiCase(const std::string& s, const std::string& pattern, std::string::size_type pos = 0);
+
+/** Приведение к нижнему регистру ASCII
+ * @param [in] text - исходный текст
+ * @return текст, в котором 'A'..'Z' заменены на 'a'..'z'
+ */
+std::string toLowerAscii(const std::string& text);
+
+/** Разбиение текста на нормализованные слова
+ * @details Слово - последовательность букв и цифр. Латиница и кириллица приводятся к нижнему регистру, "ё" заменяется на "е".
+ *  Разделители - символы ASCII кроме букв и цифр, символы U+0080..U+00BF (неразрывный пробел, кавычки "ёлочки"),
+ *  кроме букв и цифр этого диапазона (ª ² ³ µ ¹ º ¼ ½ ¾), и U+2000..U+206F (тире, многоточие и т.п.). Остальные символы UTF-8 входят в слова без изменений
+ * @param [in] data - начало текста (HTML-сущности должны быть декодированы)
+ * @param [in] size - длина текста
+ * @param [out] words - слова текста (дополняется в конец)
+ */
+void splitWords(const char* data, std::size_t size, std::vector<std::string>& words);
+
+/** Декодирование HTML-сущностей
+ * @details Заменяет сущности вида &amp;, &nbsp;, &#1234;, &#x4D2; символами в кодировке UTF-8.
+ *  Неизвестные сущности остаются без изменений
+ * @param [in] text - исходный текст
+ * @return декодированный текст
+ */
+std::string decodeHtmlEntities(const std::string& text);
+
+/** Видимый текст фрагмента HTML
+ * @details Теги, комментарии и последовательности пробельных символов заменяются одним пробелом,
+ *  пробелы в начале и в конце отбрасываются, HTML-сущности декодируются
+ * @param [in] data - начало фрагмента
+ * @param [in] size - длина фрагмента
+ * @return текст фрагмента
+ */
+std::string htmlToPlainText(const char* data, std::size_t size);
+
+/** Хэш последовательности байт
+ * @details 64-битный хэш (по схеме MurmurHash64A), обрабатывает по 8 байт за шаг
+ * @param [in] data - начало последовательности
+ * @param [in] size - длина последовательности
+ * @param [in] seed - начальное значение
+ * @return хэш
+ */
+unsigned long long hashBytes(const char* data, std::size_t size, unsigned long long seed = 0);
+
+/** Поиск значения атрибута тега
+ * @param [in] text - текст
+ * @param [in] begin_tag_pos - позиция '<' тега
+ * @param [in] end_tag_pos - позиция после '>' тега
+ * @param [in] attribute_name - имя атрибута
+ * @param [out] value - значение атрибута (без кавычек, сущности не декодируются)
+ * @return есть ли у тега атрибут
+ */
+bool findAttributeValue(const std::string& text, std::size_t begin_tag_pos, std::size_t end_tag_pos,
+                        const std::string& attribute_name, std::string& value);
+
+
 /// Ключ с его местоположением в строке
 class KeyPositionType {
 public:
@@ -152,96 +345,682 @@ public:
      */
     struct Positions
     {
-        unsigned int begin_key_area_pos, end_key_area_pos;  ///< Начало и конец зоны действия ключа
-        unsigned int begin_data_pos, end_data_pos;          ///< Начало и конец данных ключа
+        std::size_t begin_key_area_pos, end_key_area_pos;   ///< Начало и конец зоны действия ключа
+        std::size_t begin_data_pos, end_data_pos;           ///< Начало и конец данных ключа
     };
 
+    // Константы:
+    /** Наибольшая хранимая позиция (64 ГБ - 1)
+     * @details Позиции хранятся 32-битными с 4 старшими битами в общем поле, поэтому размер
+     *  KeyPositionType (20 байт) не зависит от длины текста: у текстов до 4 ГБ старшие биты нулевые.
+     *  Большие позиции усекаются, поэтому ParserTree не разбирает тексты длиннее MAX_POSITION
+     *  (ошибка "Input text is too large")
+     */
+    static const unsigned long long MAX_POSITION = (1ULL << 36) - 1;
+
 private:
+    /// Номера позиций в low_positions и high_positions
+    enum PositionNum { BEGIN_KEY_AREA, END_KEY_AREA, BEGIN_DATA, END_DATA };
+
     // Данные:
-    KeyType key;            ///< Ключ
-    Positions positions;    ///< Местоположение ключа
+    unsigned int low_positions[4];  ///< Младшие 32 бита позиций (в порядке PositionNum)
+    TagId tag_id;                   ///< Идентификатор ключа в KeySet
+    unsigned short high_positions;  ///< Старшие 4 бита позиций (по 4 бита в порядке PositionNum)
+
+    /** Чтение позиции
+     * @param [in] num - номер позиции
+     * @return позиция
+     */
+    std::size_t getPosition(PositionNum num) const
+    {
+        return static_cast<std::size_t>(low_positions[num]
+                | static_cast<unsigned long long>((high_positions >> (4 * num)) & 0xF) << 32);
+    }
+
+    /** Установка позиции
+     * @param [in] num - номер позиции
+     * @param [in] position - позиция (не больше MAX_POSITION)
+     */
+    void setPosition(PositionNum num, std::size_t position)
+    {
+        low_positions[num] = static_cast<unsigned int>(position);
+        unsigned int high = static_cast<unsigned int>(static_cast<unsigned long long>(position) >> 32) & 0xF;
+        high_positions = static_cast<unsigned short>((high_positions & ~(0xF << (4 * num))) | high << (4 * num));
+    }
 
 public:
     // Конструкторы:
     /** Конструктор
-     * @param [in] k - ключ
+     * @param [in] id - идентификатор ключа
      * @param [in] begin_key_area_position - позиция начала зоны действия ключа
      * @param [in] end_key_area_position - позиция конца зоны действия ключа
      * @param [in] begin_data_position - позиция начала данных ключа
      * @param [in] end_data_position - позиция конца данных ключа
      */
-    KeyPositionType(const KeyType& k, unsigned int begin_key_area_position, unsigned int end_key_area_position,
-                    unsigned int begin_data_position, unsigned int end_data_position)
-        : key(k)
+    KeyPositionType(TagId id, std::size_t begin_key_area_position, std::size_t end_key_area_position,
+                    std::size_t begin_data_position, std::size_t end_data_position)
+        : tag_id(id), high_positions(0)
     {
-        positions = {
-            begin_key_area_position, end_key_area_position,
-            begin_data_position, end_data_position };
+        setPosition(BEGIN_KEY_AREA, begin_key_area_position);
+        setPosition(END_KEY_AREA, end_key_area_position);
+        setPosition(BEGIN_DATA, begin_data_position);
+        setPosition(END_DATA, end_data_position);
     }
 
     /** Конструктор со структурой
-     * @param k - ключ
+     * @param id - идентификатор ключа
      * @param poss - местоположение ключа
      */
-    KeyPositionType(const KeyType& k, const Positions& poss) : key(k), positions(poss) {}
+    KeyPositionType(TagId id, const Positions& poss)
+        : KeyPositionType(id, poss.begin_key_area_pos, poss.end_key_area_pos, poss.begin_data_pos, poss.end_data_pos) {}
 
     /** Упрощённый конструктор
      * @details Любая позиция ключа = 0
-     * @param k - ключ
+     * @param id - идентификатор ключа
      */
-    explicit KeyPositionType(KeyType k) : key(k) { positions = {}; }
+    explicit KeyPositionType(TagId id) : low_positions(), tag_id(id), high_positions(0) {}
 
     // Чтение полей класса:
-    /** Чтение ключа
-     * @return ключ
+    /** Чтение идентификатора ключа
+     * @return идентификатор ключа в KeySet
      */
-    const KeyType& getKey() const                     { return key; }
+    TagId getTagId() const                            { return tag_id; }
+
+    /** Чтение местоположения ключа
+     * @return местоположение ключа
+     */
+    Positions getPositions() const
+    {
+        Positions poss = {
+            getPosition(BEGIN_KEY_AREA), getPosition(END_KEY_AREA),
+            getPosition(BEGIN_DATA), getPosition(END_DATA) };
+        return poss;
+    }
 
     /** Чтение позиции начала зоны действия ключа
      * @return Позиция начала зоны действия ключа
      */
-    unsigned int getBeginKeyAreaPosition() const      { return positions.begin_key_area_pos; }
+    std::size_t getBeginKeyAreaPosition() const       { return getPosition(BEGIN_KEY_AREA); }
 
     /** Чтение позиции конца зоны действия ключа
      * @return Позиция конца зоны действия ключа
      */
-    unsigned int getEndKeyAreaPosition() const        { return positions.end_key_area_pos; }
+    std::size_t getEndKeyAreaPosition() const         { return getPosition(END_KEY_AREA); }
 
     /** Чтение позиции начала данных ключа
      * @return Позиция начала данных ключа
      */
-    unsigned int getBeginDataPosition() const         { return positions.begin_data_pos; }
+    std::size_t getBeginDataPosition() const          { return getPosition(BEGIN_DATA); }
 
     /** Чтение позиции конца данных ключа
      * @return Позиция конца данных ключа
      */
-    unsigned int getEndDataPosition() const           { return positions.end_data_pos; }
+    std::size_t getEndDataPosition() const            { return getPosition(END_DATA); }
 
     // Установка полей класса:
-    /** Установка ключа
-     * @param [in] new_key - новый ключ
+    /** Установка идентификатора ключа
+     * @param [in] new_tag_id - новый идентификатор ключа
      */
-    void setKey(const KeyType& new_key)                       { key = new_key; }
+    void setTagId(TagId new_tag_id)                           { tag_id = new_tag_id; }
 
     /** Установка позиции начала зоны действия ключа
      * @param [in] new_position -  Новая позиция начала зоны действия ключа
      */
-    void setBeginKeyAreaPosition(unsigned int new_position)   { positions.begin_key_area_pos = new_position; }
+    void setBeginKeyAreaPosition(std::size_t new_position)    { setPosition(BEGIN_KEY_AREA, new_position); }
 
     /** Установка позиции конца зоны действия ключа
      * @param [in] new_position - Новая позиция конца зоны действия ключа
      */
-    void setEndKeyAreaPosition(unsigned int new_position)     { positions.end_key_area_pos = new_position; }
+    void setEndKeyAreaPosition(std::size_t new_position)      { setPosition(END_KEY_AREA, new_position); }
 
     /** Установка позиции начала данных ключа
      * @param [in] new_position - Новая позиция начала данных ключа
      */
-    void setBeginDataPosition(unsigned int new_position)      { positions.begin_data_pos = new_position; }
+    void setBeginDataPosition(std::size_t new_position)       { setPosition(BEGIN_DATA, new_position); }
 
     /** Установка позиции конца данных ключа
      * @param [in] new_position - Новая позиция конца данных ключа
      */
-    void setEndDataPosition(unsigned int new_position)        { positions.end_data_pos = new_position; }
+    void setEndDataPosition(std::size_t new_position)         { setPosition(END_DATA, new_position); }
+};
+
+
+/// Поток ключей: местоположения ключей в порядке следования в тексте, без построения дерева
+class TokenStream {
+public:
+    // Новые типы данных:
+    /** Вид элемента потока
+     * @value OPEN Начало ключевой области ключа с данными
+     * @value CLOSE Конец данных ключа с данными
+     * @value EMPTY Пустой элемент (ключ без данных)
+     */
+    enum TokenKind { OPEN, CLOSE, EMPTY };
+
+    /** Упакованный элемент потока (16 байт)
+     * @details Хранит все четыре позиции ключа: begin_data_pos и end_key_area_pos записаны смещениями.
+     *  Если смещение не помещается в 16 бит или позиция - в 32 бита (текст больше 4 ГБ), устанавливается
+     *  флаг LONG_POSITIONS, а полные позиции хранятся отдельно (см. getPositions() и getTokenPosition())
+     */
+    struct Token
+    {
+        unsigned int begin_key_area_pos;     ///< Начало зоны действия ключа
+        unsigned int end_data_pos;           ///< Конец данных ключа
+        unsigned short begin_data_offset;    ///< begin_data_pos - begin_key_area_pos
+        unsigned short end_key_area_offset;  ///< end_key_area_pos - end_data_pos
+        TagId tag_id;                        ///< Идентификатор ключа в KeySet
+        unsigned char kind;                  ///< Вид элемента (TokenKind)
+        unsigned char flags;                 ///< Флаги (LONG_POSITIONS)
+    };
+
+    /// Флаг элемента: смещения или позиции не помещаются в Token
+    static const unsigned char LONG_POSITIONS = 1;
+
+    /// Итератор по элементам потока
+    typedef const Token* const_iterator;
+
+    /// Отрезок потока [first, second)
+    typedef std::pair<const_iterator, const_iterator> Range;
+
+private:
+    // Данные:
+    std::vector<Token> tokens;                          ///< Элементы потока
+    std::vector<unsigned int> pairs;                    ///< Номера парных элементов (пусто, если не построены)
+    std::map<unsigned int, KeyPositionType::Positions> long_positions;  ///< Полные позиции элементов с LONG_POSITIONS
+
+public:
+    /** Конструктор
+     * @param [in] key_positions - местоположения ключей, отсортированные по началу зоны действия
+     *  (например, ParserTree::getKeyPositions())
+     * @param [in] build_pairs - строить ли индекс парных элементов OPEN - CLOSE
+     */
+    explicit TokenStream(const std::vector<KeyPositionType>& key_positions, bool build_pairs = true);
+
+    // Доступ к элементам:
+    /** Количество элементов
+     * @return количество элементов потока
+     */
+    std::size_t size() const                            { return tokens.size(); }
+
+    /** Проверка на пустоту
+     * @return пуст ли поток
+     */
+    bool empty() const                                  { return tokens.empty(); }
+
+    /** Упакованный массив элементов
+     * @return указатель на первый элемент
+     */
+    const Token* data() const                           { return tokens.data(); }
+
+    const_iterator begin() const                        { return tokens.data(); }
+    const_iterator end() const                          { return tokens.data() + tokens.size(); }
+    const Token& operator[](std::size_t token_num) const { return tokens[token_num]; }
+
+    /** Позиция элемента в тексте
+     * @param [in] token_num - номер элемента
+     * @return begin_key_area_pos для OPEN и EMPTY, end_data_pos для CLOSE
+     */
+    std::size_t getTokenPosition(std::size_t token_num) const;
+
+    /** Полное местоположение ключа элемента
+     * @param [in] token_num - номер элемента
+     * @return местоположение ключа
+     */
+    KeyPositionType::Positions getPositions(std::size_t token_num) const;
+
+    /** Проверка наличия индекса парных элементов
+     * @return построен ли индекс
+     */
+    bool hasPairs() const                               { return !pairs.empty() || tokens.empty(); }
+
+    /** Номер парного элемента
+     * @details Для OPEN - номер CLOSE, для CLOSE - номер OPEN, для EMPTY - сам элемент.
+     *  Требует индекса парных элементов
+     * @param [in] token_num - номер элемента
+     * @return номер парного элемента
+     */
+    unsigned int getPair(std::size_t token_num) const   { return pairs[token_num]; }
+
+    // Отрезки потока:
+    /** Элементы, расположенные в тексте в [begin_pos, end_pos)
+     * @param [in] begin_pos - начало отрезка текста
+     * @param [in] end_pos - конец отрезка текста
+     * @return отрезок потока
+     */
+    Range range(std::size_t begin_pos, std::size_t end_pos) const;
+
+    /** Элементы ключа вместе с вложенными
+     * @details Для OPEN - от него до парного CLOSE включительно, для EMPTY - только он сам.
+     *  При перекрывающихся тегах отрезок содержит и часть элементов ключей, перекрывающих данный.
+     *  Требует индекса парных элементов
+     * @param [in] token_num - номер элемента OPEN или EMPTY
+     * @return отрезок потока
+     */
+    Range elementRange(std::size_t token_num) const;
+};
+
+
+/// Последовательный поиск тегов в тексте за один проход (без вектора местоположений и дерева)
+class TagScanner {
+public:
+    // Новые типы данных:
+    /** Вид тега
+     * @value OPEN_TAG Открывающий тег ("<div ...>")
+     * @value CLOSE_TAG Закрывающий тег ("</div>")
+     * @value EMPTY_TAG Пустой элемент ("<br>") или самозакрывающийся тег ("<div/>")
+     */
+    enum TagKind { OPEN_TAG, CLOSE_TAG, EMPTY_TAG };
+
+    /// Найденный тег
+    struct Tag
+    {
+        TagId tag_id;               ///< Идентификатор ключа в KeySet
+        TagKind kind;               ///< Вид тега
+        std::size_t begin_pos;      ///< Позиция '<'
+        std::size_t end_pos;        ///< Позиция после '>'
+    };
+
+private:
+    // Данные:
+    const std::string& text;        ///< Текст
+    const KeySet& keys;             ///< Множество ключей
+    std::string::size_type pos;     ///< Текущая позиция поиска
+    TagId script_tag_id;            ///< Ключи, данные которых не содержат тегов
+    TagId style_tag_id;
+
+public:
+    /** Конструктор
+     * @param [in] s - текст, должен существовать всё время работы
+     * @param [in] key_set - множество ключей; теги, которых нет в множестве, пропускаются
+     * @param [in] begin_pos - позиция начала поиска
+     */
+    TagScanner(const std::string& s, const KeySet& key_set, std::size_t begin_pos = 0);
+
+    /** Поиск следующего тега
+     * @details Комментарии, "<!DOCTYPE>" и данные script и style пропускаются
+     * @param [out] tag - найденный тег
+     * @return найден ли тег
+     */
+    bool next(Tag& tag);
+
+    /** Чтение текущей позиции
+     * @return количество просмотренных символов текста
+     */
+    std::size_t getPosition() const             { return pos; }
+};
+
+
+/// Выборочное извлечение элементов с остановкой после нахождения требуемых
+class ElementExtractor {
+private:
+    // Новые типы данных:
+    /// Шаг пути: тег и необязательное условие на атрибут
+    struct PathStep
+    {
+        TagId tag_id;
+        std::string attribute_name;     ///< Имя атрибута (пусто - без условия)
+        std::string attribute_value;    ///< Значение атрибута (пусто - достаточно наличия атрибута)
+        bool check_value;
+    };
+    /// Цель извлечения
+    struct Target
+    {
+        std::vector<PathStep> steps;    ///< Шаги пути от предка к искомому тегу
+        bool from_root;                 ///< Путь начинается с корня ("/html/head/title")
+    };
+
+    // Данные:
+    const KeySet& keys;                 ///< Множество ключей
+    std::vector<Target> targets;        ///< Цели извлечения
+    unsigned int limit;                 ///< Количество элементов каждой цели
+    std::string error_description;      ///< Описание ошибок в целях
+
+public:
+    /** Конструктор
+     * @details Цель - имя тега ("title") или путь через '/' ("head/title", "/html/body/h1"),
+     *  у каждого шага может быть условие на атрибут: "meta[name=description]", "a[href]".
+     *  Путь без ведущего '/' сравнивается с ближайшими предками элемента
+     * @param [in] key_set - множество ключей, должно существовать всё время работы
+     * @param [in] target_paths - цели извлечения
+     * @param [in] count_limit - сколько элементов каждой цели нужно (0 - все)
+     */
+    ElementExtractor(const KeySet& key_set, const std::vector<std::string>& target_paths, unsigned int count_limit = 1);
+
+    /** Извлечение элементов
+     * @details Текст просматривается по порядку, поиск заканчивается, как только
+     *  для каждой цели найдено count_limit элементов вместе с их закрывающими тегами
+     * @param [in] text - текст
+     * @param [out] results - местоположения найденных элементов, results[i] для i-й цели
+     * @return количество просмотренных символов текста
+     */
+    std::size_t extract(const std::string& text, std::vector<std::vector<KeyPositionType>>& results) const;
+
+    /** Чтение ошибок в целях
+     * @return описание целей, которые не удалось разобрать (такие цели не находят элементов)
+     */
+    const std::string& getErrorDescription() const      { return error_description; }
+
+private:
+    bool matchStep(const PathStep& step, TagId tag_id, const std::string& text,
+                   std::size_t begin_tag_pos, std::size_t end_tag_pos) const;
+};
+
+
+/// Отрезок текста без копирования
+struct TextView
+{
+    const char* data;               ///< Начало отрезка
+    std::size_t size;               ///< Длина отрезка
+
+    /** Копия отрезка
+     * @return строка с символами отрезка
+     */
+    std::string toString() const    { return std::string(data, size); }
+};
+
+
+/// Строка таблицы
+struct TableRow
+{
+    unsigned int table_num;         ///< Номер таблицы в порядке открывающих тегов <table> (с 0)
+    unsigned int depth;             ///< Вложенность таблицы (0 - таблица вне других таблиц)
+    unsigned int row_num;           ///< Номер строки в таблице (с 0)
+    std::vector<TextView> cells;    ///< Данные ячеек <td> и <th> (без пробелов по краям, теги и сущности не обрабатываются)
+};
+
+
+/// Получатель строк таблиц
+class TableRowHandler {
+public:
+    /** Деструктор
+     */
+    virtual ~TableRowHandler() {}
+
+    /** Обработка строки
+     * @param [in] row - строка; отрезки ячеек указывают в текст, строка действительна только во время вызова
+     */
+    virtual void addRow(const TableRow& row) = 0;
+};
+
+
+/// Потоковое извлечение строк таблиц без построения дерева
+class TableExtractor {
+private:
+    // Данные:
+    KeySet keys;                    ///< Ключи таблиц (<table>, <tr>, <td>, <th>, а также <script> и <style> для пропуска их данных)
+    TagId table_tag_id;
+    TagId row_tag_id;
+    TagId data_cell_tag_id;
+    TagId header_cell_tag_id;
+
+public:
+    /** Конструктор
+     * @details Имена тегов сравниваются без учёта регистра ASCII
+     */
+    TableExtractor();
+
+    /** Извлечение строк таблиц
+     * @details Текст просматривается один раз сканером тегов (см. TagScanner). Строка передаётся получателю,
+     *  как только закрывается (</tr>, следующий <tr> или </table>), поэтому память ограничена одной строкой
+     *  на каждый уровень вложенности таблиц. Незакрытые <td>, <th> и <tr> закрываются следующей ячейкой или строкой.
+     *  Строки вложенной таблицы передаются раньше строки внешней таблицы, в ячейке которой она находится;
+     *  данные такой ячейки включают вложенную таблицу целиком. Ячейки вне <tr> образуют строку
+     * @param [in] text - текст, должен существовать, пока используются отрезки ячеек
+     * @param [in] handler - получатель строк
+     * @return количество переданных строк
+     */
+    std::size_t extract(const std::string& text, TableRowHandler& handler) const;
+};
+
+
+/// Запись строк таблиц в формате CSV
+class CsvTableWriter : public TableRowHandler {
+private:
+    // Данные:
+    std::ostream& output;           ///< Поток вывода
+    char separator;                 ///< Разделитель полей
+    bool write_table_num;           ///< Первое поле строки - номер таблицы
+    bool plain_text;                ///< Записывать видимый текст ячеек (см. htmlToPlainText())
+    std::string cell_text;          ///< Буфер текста ячейки
+
+public:
+    /** Конструктор
+     * @param [in] out - поток вывода, должен существовать всё время работы
+     * @param [in] field_separator - разделитель полей
+     * @param [in] with_table_num - первым полем записывать номер таблицы
+     * @param [in] as_plain_text - записывать видимый текст ячеек вместо исходного HTML
+     */
+    CsvTableWriter(std::ostream& out, char field_separator = ',', bool with_table_num = true, bool as_plain_text = true)
+        : output(out), separator(field_separator), write_table_num(with_table_num), plain_text(as_plain_text) {}
+
+    /** Запись строки
+     * @details Поля с разделителем, кавычками или переводами строк заключаются в кавычки, кавычки удваиваются.
+     *  Строки заканчиваются "\r\n" (RFC 4180)
+     * @param [in] row - строка
+     */
+    void addRow(const TableRow& row) override;
+};
+
+
+/// Столбцы строк таблиц
+class ColumnarTable : public TableRowHandler {
+private:
+    // Данные:
+    std::vector<std::vector<TextView>> columns;     ///< Ячейки по столбцам, у строк с меньшим числом ячеек - пустые отрезки
+    std::vector<unsigned int> row_tables;           ///< Номера таблиц строк
+    bool has_table_filter;                          ///< Сохраняются строки только одной таблицы
+    unsigned int filter_table_num;                  ///< Номер сохраняемой таблицы
+
+public:
+    /** Конструктор
+     * @details Сохраняются строки всех таблиц
+     */
+    ColumnarTable() : has_table_filter(false), filter_table_num(0) {}
+
+    /** Конструктор
+     * @param [in] table_num - номер таблицы, строки которой сохраняются
+     */
+    explicit ColumnarTable(unsigned int table_num) : has_table_filter(true), filter_table_num(table_num) {}
+
+    /** Добавление строки
+     * @param [in] row - строка
+     */
+    void addRow(const TableRow& row) override;
+
+    /** Очистка
+     */
+    void clear();
+
+    // Чтение полей класса:
+    /** Количество строк
+     * @return количество строк
+     */
+    std::size_t getRowsCount() const                                { return row_tables.size(); }
+
+    /** Количество столбцов
+     * @return наибольшее количество ячеек в строке
+     */
+    std::size_t getColumnsCount() const                             { return columns.size(); }
+
+    /** Чтение столбца
+     * @param [in] column_num - номер столбца
+     * @return ячейки столбца, по одной на строку
+     */
+    const std::vector<TextView>& getColumn(std::size_t column_num) const   { return columns[column_num]; }
+
+    /** Чтение ячейки
+     * @param [in] row_num - номер строки
+     * @param [in] column_num - номер столбца
+     * @return отрезок ячейки (пустой, если в строке нет такой ячейки)
+     */
+    const TextView& getCell(std::size_t row_num, std::size_t column_num) const { return columns[column_num][row_num]; }
+
+    /** Чтение номера таблицы строки
+     * @param [in] row_num - номер строки
+     * @return номер таблицы
+     */
+    unsigned int getTableNum(std::size_t row_num) const             { return row_tables[row_num]; }
+};
+
+
+/// Хранилище текстовых отрывков дерева
+class TextPool {
+private:
+    // Данные:
+    std::deque<std::string> texts;                  ///< Отрывки без интернирования (адреса не меняются при добавлении)
+    std::unordered_set<std::string> interned_texts; ///< Интернированные отрывки (по одному экземпляру на значение)
+    unsigned int count_intern_requests;             ///< Количество запросов на интернирование
+    std::size_t bytes;                              ///< Приблизительный объём памяти отрывков
+
+public:
+    /** Конструктор
+     */
+    TextPool() : count_intern_requests(0), bytes(0) {}
+
+    /** Добавление отрывка без интернирования
+     * @param [in] text - текстовый отрывок
+     * @return указатель на сохранённый отрывок, действителен всё время жизни хранилища
+     */
+    const std::string* add(std::string&& text);
+
+    /** Добавление отрывка с интернированием
+     * @details Одинаковые отрывки хранятся в одном экземпляре
+     * @param [in] text - текстовый отрывок
+     * @return указатель на сохранённый отрывок, действителен всё время жизни хранилища
+     */
+    const std::string* intern(std::string&& text);
+
+    // Чтение полей класса:
+    /** Количество отрывков без интернирования
+     * @return количество отрывков без интернирования
+     */
+    std::size_t getTextsCount() const                 { return texts.size(); }
+
+    /** Количество различных интернированных отрывков
+     * @return количество различных интернированных отрывков
+     */
+    std::size_t getInternedTextsCount() const         { return interned_texts.size(); }
+
+    /** Количество запросов на интернирование
+     * @return количество запросов на интернирование (в том числе повторных)
+     */
+    unsigned int getCountInternRequests() const       { return count_intern_requests; }
+
+    /** Объём памяти отрывков
+     * @details Оценка: строки и их буферы, без служебных данных контейнеров
+     * @return приблизительное количество байт, занимаемых отрывками
+     */
+    std::size_t getBytes() const                      { return bytes; }
+};
+
+
+/// Инвертированный индекс слов текстов узлов
+class TextIndex {
+public:
+    // Новые типы данных:
+    /// Вхождение слова
+    struct Posting
+    {
+        unsigned int pre_order;     ///< Номер узла в прямом порядке обхода
+        unsigned int word_num;      ///< Номер слова среди собственных текстов узла
+    };
+
+    // Константы:
+    /// Наибольший номер слова узла (номера хранятся в Posting 32-битными)
+    static const unsigned int MAX_WORD_NUM = 0xFFFFFFFE;
+
+private:
+    // Данные:
+    /** Вхождения слов
+     * @details Вхождения каждого слова упорядочены по узлам в порядке документа, внутри узла - по номеру слова
+     */
+    std::unordered_map<std::string, std::vector<Posting>> postings;
+    std::size_t bytes;              ///< Приблизительный объём памяти индекса
+
+public:
+    /** Конструктор
+     */
+    TextIndex() : bytes(0) {}
+
+    /** Добавление текста узла
+     * @details Узлы добавляются в прямом порядке обхода, тексты узла - в порядке следования.
+     *  Между текстами узла пропускается один номер слова, поэтому фраза не может начинаться
+     *  в одном тексте и заканчиваться в другом (их разделяет дочерний узел)
+     * @param [in] pre_order - номер узла в прямом порядке обхода
+     * @param [in] data - начало текста (HTML-сущности декодируются)
+     * @param [in] size - длина текста
+     * @param [in,out] word_num - номер следующего слова узла (0 для первого текста узла)
+     * @return false, если номер слова превысил бы MAX_WORD_NUM (слова текста не добавляются)
+     */
+    bool addText(unsigned int pre_order, const char* data, std::size_t size, unsigned int& word_num);
+
+    /** Поиск узлов по фразе
+     * @details Фраза разбивается на слова так же, как тексты (см. splitWords()). Просматриваются только
+     *  вхождения слов фразы, начиная с самого редкого
+     * @param [in] phrase - слово или несколько слов
+     * @return номера узлов в прямом порядке обхода, собственные тексты которых содержат слова фразы подряд
+     *  (по возрастанию, без повторов)
+     */
+    std::vector<unsigned int> findPhrase(const std::string& phrase) const;
+
+    /** Очистка индекса
+     */
+    void clear();
+
+    // Чтение полей класса:
+    /** Количество различных слов
+     * @return количество различных слов
+     */
+    std::size_t getWordsCount() const                 { return postings.size(); }
+
+    /** Объём памяти индекса
+     * @details Оценка: слова, их буферы и векторы вхождений, без служебных данных хэш-таблицы
+     * @return приблизительное количество байт, занимаемых индексом
+     */
+    std::size_t getBytes() const                      { return bytes; }
+};
+
+
+/// Управление разбором из другого потока
+/** @details Передаётся в ParseOptions::control. Поток разбора сообщает о просмотренных байтах,
+ *  другой поток может читать их и запросить отмену. Отмена проверяется при поиске местоположений ключей
+ *  и при построении узлов; разбор завершается с ошибкой "Parsing cancelled"
+ */
+class ParseControl {
+private:
+    // Данные:
+    std::atomic<bool> cancelled;                ///< Запрошена отмена
+    std::atomic<std::size_t> bytes_scanned;     ///< Просмотрено байт
+    std::atomic<std::size_t> bytes_total;       ///< Всего байт к просмотру (0, пока неизвестно)
+
+public:
+    /** Конструктор
+     */
+    ParseControl() : cancelled(false), bytes_scanned(0), bytes_total(0) {}
+
+    /** Запрос отмены разбора
+     * @details Может вызываться из любого потока
+     */
+    void cancel()                                     { cancelled.store(true, std::memory_order_relaxed); }
+
+    /** Проверка отмены
+     * @return запрошена ли отмена разбора
+     */
+    bool isCancelled() const                          { return cancelled.load(std::memory_order_relaxed); }
+
+    /** Количество просмотренных байт
+     * @details Поиск каждого ключа и построение дерева просматривают текст отдельно, см. getBytesTotal()
+     * @return количество просмотренных байт
+     */
+    std::size_t getBytesScanned() const               { return bytes_scanned.load(std::memory_order_relaxed); }
+
+    /** Общее количество байт к просмотру
+     * @return общее количество байт (0, пока разбор не начат)
+     */
+    std::size_t getBytesTotal() const                 { return bytes_total.load(std::memory_order_relaxed); }
+
+    // Установка полей класса (поток разбора):
+    void setBytesScanned(std::size_t bytes)           { bytes_scanned.store(bytes, std::memory_order_relaxed); }
+    void setBytesTotal(std::size_t bytes)             { bytes_total.store(bytes, std::memory_order_relaxed); }
 };
 
 
@@ -258,10 +1037,36 @@ public:
      */
     enum TextOrChild { TEXT, CHILD };
 
+    /** Состояние декодирования текста
+     * @value NOT_DECODED Текст ещё не проверялся
+     * @value NO_ENTITIES Текст не содержит '&', декодированный текст совпадает с исходным
+     * @value DECODED Декодированный текст находится в кэше декодированных текстов
+     */
+    enum DecodeState { NOT_DECODED, NO_ENTITIES, DECODED };
+
+    /// Номер местоположения корневого узла (у него нет ключа в тексте)
+    static const unsigned int ROOT_KEY_POSITION_NUM = static_cast<unsigned int>(-1);
+
 private:
+    /// Кэш декодированных текстов (определён в parser.cpp)
+    struct DecodeCache;
+
     // Данные:
-    KeyType key;                          ///< Ключ
-    std::vector<std::string> texts;       ///< Вектор текстовых данных, не содержащих ключи
+    TagId tag_id;                         ///< Идентификатор ключа в KeySet дерева
+    unsigned int key_position_num;        ///< Номер местоположения ключа в векторе местоположений дерева
+    const ParserTreeSource* source;       ///< Исходные данные узла: текст, местоположения ключей, тексты (nullptr до добавления в дерево)
+    bool lazy;                            ///< Данные узла строятся из source при первом обращении
+    mutable std::once_flag materialize_flag;  ///< Флаг однократного построения данных узла
+    ParserTreeItem* parent;               ///< Родительский узел (nullptr для корневого)
+
+    // Нумерация для проверки вложенности:
+    unsigned int pre_order;     /**< Номер узла в прямом порядке обхода
+     * @details Коренной узел - 0, у остальных совпадает с номером местоположения ключа + 1
+     */
+    unsigned int subtree_end;   /**< Номер после последнего потомка
+     * @details Потомки узла - узлы с номерами [pre_order + 1, subtree_end)
+     */
+    std::vector<const std::string*> texts;  ///< Вектор текстовых данных, не содержащих ключи (хранятся в TextPool дерева)
     std::vector<ParserTreeItem*> childs;                  ///< Вектор дочерних узлов
     /** Последовательность вхождений
      * @details Вектор, содержащий последовательность вхождений текстовых отрывков и других ключей, находящиеся в
@@ -269,6 +1074,11 @@ private:
      */
     std::vector<TextOrChild> location_sequence_of_data;
 
+    /** Кэш декодированных текстов
+     * @details Создаётся при первом вызове getDecodedText(): большинство узлов тексты не декодируют
+     */
+    mutable std::atomic<DecodeCache*> decode_cache;
+
     // Позиция:
     int row;       /**< Ряд
      * @details "Глубина" дерева, начинается с нуля
@@ -280,22 +1090,44 @@ private:
 public:
     // Методы:
     /** Конструктор
-     * @param [in] k - ключ
+     * @param [in] id - идентификатор ключа
+     * @param [in] position_num - номер местоположения ключа (ROOT_KEY_POSITION_NUM для корневого узла)
      * @param [in] row_position - ряд
      * @param [in] column_position - колонна
      */
-    ParserTreeItem(const KeyType& k, int row_position, int column_position = 0);
+    ParserTreeItem(TagId id, unsigned int position_num, int row_position, int column_position = 0);
+
+    /** Деструктор
+     * @details Дочерние узлы не удаляются (их удаляет дерево)
+     */
+    ~ParserTreeItem();
 
     // Чтение полей класса:
-    /** Чтение ключа
-     * @return ключ
+    /** Чтение идентификатора ключа
+     * @details Имя и функции ключа можно узнать при помощи ParserTree::getKey()
+     * @return идентификатор ключа в KeySet дерева
      */
-    const KeyType& getKey() const;
+    TagId getTagId() const;
+
+    /** Чтение номера местоположения ключа
+     * @return номер местоположения ключа в векторе местоположений дерева
+     */
+    unsigned int getKeyPositionNum() const;
 
     /** Чтение вектора текстовых данных, не содержащих ключи
-     * @return вектор текстовых данных, не содержащих ключи
+     * @details Интернированные отрывки разных узлов могут указывать на одну строку
+     * @return вектор указателей на текстовые данные, не содержащие ключи
+     */
+    const std::vector<const std::string*>& getTexts() const;
+
+    /** Чтение декодированного текста
+     * @details Текст декодируется при первом обращении к нему, результат кэшируется. Потокобезопасно, в том числе
+     *  для текстов, добавленных после первого обращения. Если текст не содержит '&', возвращается исходный текст
+     *  без копирования. Ссылка действительна до изменения узла (spliceSubtree(), удаление текстов)
+     * @param [in] text_num - номер текста в векторе текстовых данных
+     * @return текст с заменёнными HTML-сущностями
      */
-    const std::vector<std::string>& getTexts() const;
+    const std::string& getDecodedText(unsigned int text_num) const;
 
     /** Чтение вектора дочерних узлов
      * @return вектор дочерних узлов
@@ -317,11 +1149,34 @@ public:
      */
     int getColumn() const;
 
+    /** Чтение родительского узла
+     * @return родительский узел (nullptr для корневого)
+     */
+    ParserTreeItem* getParent() const;
+
+    /** Чтение номера в прямом порядке обхода
+     * @return номер узла в прямом порядке обхода
+     */
+    unsigned int getPreOrder() const;
+
+    /** Чтение номера после последнего потомка
+     * @return номер в прямом порядке обхода, следующий за поддеревом узла
+     */
+    unsigned int getSubtreeEnd() const;
+
+    /** Проверка вложенности за O(1)
+     * @param [in] item - узел того же дерева
+     * @return является ли узел предком item
+     * @note После detachSubtree() и spliceSubtree() номера узлов действительны после ParserTree::updateIndices()
+     */
+    bool isAncestorOf(const ParserTreeItem& item) const;
+
     // Установка полей класса:
     /** Добавления текста, не содержащего ключи
      * @param [in] text_part - текст, не содержащий ключи
+     * @note Текст не копируется и должен существовать всё время жизни узла (см. TextPool)
      */
-    void addText(const std::string& text_part);
+    void addText(const std::string* text_part);
 
     /** Добавление дочернего узла (вложенного ключа)
      * @param [in] item - дочерний узел
@@ -336,8 +1191,143 @@ public:
      * @details Удаляет всю ветку дочернего узла
      */
     void deleteLastChild();
+
+private:
+    /** Построение данных отложенного узла
+     * @details Для узлов отложенного дерева (ParseOptions::lazy_tree) дочерние узлы и тексты
+     *  строятся при первом вызове getChilds(), getTexts() и т.п. Потокобезопасно, выполняется один раз
+     */
+    void materialize() const;
+
+    /** Декодирование текста в кэш
+     * @param [in,out] cache - кэш узла (его mutex захвачен)
+     * @param [in] text_num - номер текста
+     */
+    void decodeText(DecodeCache& cache, unsigned int text_num) const;
+
+    /** Удаление кэша декодированных текстов
+     * @details Только при изменении узла (без одновременного чтения)
+     */
+    void clearDecodeCache();
+
+    friend class ParserTree;
+    friend class ParserTreeSource;
+};
+
+
+/** Итератор обхода поддерева в прямом порядке (предок перед потомками)
+ * @details Не выделяет память: следующий узел находится по ссылке на родителя и колонне узла.
+ *  Узлы отложенного дерева строятся при переходе к их дочерним узлам
+ * @note После detachSubtree() и spliceSubtree() колонны узлов действительны после ParserTree::updateIndices()
+ */
+class ParserTreePreOrderIterator {
+public:
+    // Новые типы данных (для стандартных алгоритмов):
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ParserTreeItem value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const ParserTreeItem* pointer;
+    typedef const ParserTreeItem& reference;
+
+private:
+    // Данные:
+    const ParserTreeItem* item;             ///< Текущий узел (nullptr - конец обхода)
+    const ParserTreeItem* subtree_root;     ///< Корень обходимого поддерева
+
+public:
+    /** Конструктор
+     * @param [in] subtree - корень обходимого поддерева (nullptr - конец обхода)
+     */
+    explicit ParserTreePreOrderIterator(const ParserTreeItem* subtree = nullptr) : item(subtree), subtree_root(subtree) {}
+
+    // Операторы:
+    reference operator*() const                                     { return *item; }
+    pointer operator->() const                                      { return item; }
+    bool operator==(const ParserTreePreOrderIterator& it) const      { return item == it.item; }
+    bool operator!=(const ParserTreePreOrderIterator& it) const      { return item != it.item; }
+
+    /** Переход к следующему узлу
+     * @return итератор следующего узла
+     */
+    ParserTreePreOrderIterator& operator++();
+    ParserTreePreOrderIterator operator++(int)                      { ParserTreePreOrderIterator it(*this); ++*this; return it; }
+};
+
+
+/** Итератор обхода поддерева в обратном порядке (потомки перед предком)
+ * @details Не выделяет память, как и ParserTreePreOrderIterator. Корень поддерева обходится последним
+ * @note После detachSubtree() и spliceSubtree() колонны узлов действительны после ParserTree::updateIndices()
+ */
+class ParserTreePostOrderIterator {
+public:
+    // Новые типы данных (для стандартных алгоритмов):
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ParserTreeItem value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const ParserTreeItem* pointer;
+    typedef const ParserTreeItem& reference;
+
+private:
+    // Данные:
+    const ParserTreeItem* item;             ///< Текущий узел (nullptr - конец обхода)
+    const ParserTreeItem* subtree_root;     ///< Корень обходимого поддерева
+
+public:
+    /** Конструктор
+     * @details Итератор указывает на первый узел обхода - самый левый лист поддерева
+     * @param [in] subtree - корень обходимого поддерева (nullptr - конец обхода)
+     */
+    explicit ParserTreePostOrderIterator(const ParserTreeItem* subtree = nullptr);
+
+    // Операторы:
+    reference operator*() const                                     { return *item; }
+    pointer operator->() const                                      { return item; }
+    bool operator==(const ParserTreePostOrderIterator& it) const     { return item == it.item; }
+    bool operator!=(const ParserTreePostOrderIterator& it) const     { return item != it.item; }
+
+    /** Переход к следующему узлу
+     * @return итератор следующего узла
+     */
+    ParserTreePostOrderIterator& operator++();
+    ParserTreePostOrderIterator operator++(int)                     { ParserTreePostOrderIterator it(*this); ++*this; return it; }
+};
+
+
+/** Диапазон обхода поддерева (для range-for и стандартных алгоритмов)
+ * @tparam Iterator - ParserTreePreOrderIterator или ParserTreePostOrderIterator
+ */
+template <class Iterator>
+class ParserTreeRange {
+    const ParserTreeItem* subtree_root;     ///< Корень обходимого поддерева
+
+public:
+    /** Конструктор
+     * @param [in] subtree - корень обходимого поддерева
+     */
+    explicit ParserTreeRange(const ParserTreeItem* subtree) : subtree_root(subtree) {}
+
+    Iterator begin() const          { return Iterator(subtree_root); }
+    Iterator end() const            { return Iterator(); }
 };
 
+/// Обход поддерева в прямом порядке
+typedef ParserTreeRange<ParserTreePreOrderIterator> ParserTreePreOrderRange;
+/// Обход поддерева в обратном порядке
+typedef ParserTreeRange<ParserTreePostOrderIterator> ParserTreePostOrderRange;
+
+/** Обход поддерева в прямом порядке
+ * @details for (const ParserTreeItem& item : preOrder(subtree)) ...
+ * @param [in] subtree - корень поддерева (входит в обход)
+ * @return диапазон обхода
+ */
+inline ParserTreePreOrderRange preOrder(const ParserTreeItem& subtree)      { return ParserTreePreOrderRange(&subtree); }
+
+/** Обход поддерева в обратном порядке
+ * @param [in] subtree - корень поддерева (входит в обход последним)
+ * @return диапазон обхода
+ */
+inline ParserTreePostOrderRange postOrder(const ParserTreeItem& subtree)    { return ParserTreePostOrderRange(&subtree); }
+
 
 // TODO: Задокументировать
 class ParserTree {
@@ -345,23 +1335,165 @@ public:
     // Новые типы данных:
     typedef std::stack<ParserTreeItem*, std::vector<ParserTreeItem*>> ParserTreeItemStack;
 
+    /** Обработка пробельных отрывков текста (состоящих только из пробелов, табуляций и переводов строк)
+     * @value KEEP_WHITESPACE Сохранять отрывки без изменений
+     * @value COLLAPSE_WHITESPACE Заменять отрывок одним символом: "\n", если он содержит перевод строки, иначе " "
+     * @value DROP_WHITESPACE Не добавлять отрывки в дерево
+     */
+    enum WhitespaceMode { KEEP_WHITESPACE, COLLAPSE_WHITESPACE, DROP_WHITESPACE };
+
+    /// Различие между деревьями (см. diff())
+    struct TreeDifference
+    {
+        /** Вид различия
+         * @value INSERTED Узел new_item есть только в новом дереве
+         * @value REMOVED Узел old_item есть только в старом дереве
+         * @value CHANGED У узлов old_item и new_item различаются ключи или тексты (дочерние узлы сравниваются отдельно)
+         */
+        enum Kind { INSERTED, REMOVED, CHANGED };
+
+        Kind kind;                          ///< Вид различия
+        const ParserTreeItem* old_item;     ///< Узел старого дерева (nullptr для INSERTED)
+        const ParserTreeItem* new_item;     ///< Узел нового дерева (nullptr для REMOVED)
+    };
+
+    /// Место узла в данных родителя (см. detachSubtree(), spliceSubtree())
+    struct ItemSlot
+    {
+        const ParserTreeItem* parent;   ///< Родительский узел
+        unsigned int sequence_pos;      ///< Номер в последовательности вхождений родителя (getLocationSequenceOfData())
+    };
+
+    /// Параметры разбора
+    struct ParseOptions
+    {
+        WhitespaceMode whitespace_mode;         ///< Обработка пробельных отрывков
+        bool intern_texts;                      ///< Интернировать короткие отрывки в TextPool дерева
+        unsigned int max_interned_text_length;  ///< Максимальная длина интернируемого отрывка
+        /** Отложенное построение дерева
+         * @details createTree() строит только дочерние узлы коренного, данные остальных узлов
+         *  строятся из местоположений ключей при первом обращении к ним
+         */
+        bool lazy_tree;
+        /** Бюджет памяти дерева в байтах (0 - без ограничения)
+         * @details При превышении разбор прекращается с ошибкой в getErrorDescription().
+         *  Учитывается оценка getMemoryUsage(); узлы отложенного дерева, построенные после createTree(), не ограничиваются
+         */
+        std::size_t memory_budget;
+        /** Управление разбором из другого потока (nullptr - без управления)
+         * @details Используется конструктором и createTree(), после createTree() сбрасывается в nullptr
+         */
+        ParseControl* control;
+        /** Построить индекс начал строк при разборе
+         * @details Без него индекс строится при первом вызове lineColumn()
+         */
+        bool line_index;
+        /** Построить в createTree() инвертированный индекс слов текстов (см. findText())
+         * @details Строится по местоположениям ключей, поэтому не требует построения отложенных узлов.
+         *  Без него индекс строится при первом вызове findText()
+         */
+        bool text_index;
+
+        ParseOptions() : whitespace_mode(KEEP_WHITESPACE), intern_texts(false), max_interned_text_length(32),
+            lazy_tree(false), memory_budget(0), control(nullptr), line_index(false), text_index(false) {}
+    };
+
+    /// Строка и колонка позиции в исходном тексте (см. lineColumn())
+    struct LineColumn
+    {
+        std::size_t line;       ///< Номер строки, начинается с 1
+        std::size_t column;     ///< Номер байта в строке, начинается с 1 (символы UTF-8 не учитываются, '\r' входит в строку)
+    };
+
+    /// Оценка памяти дерева (см. getMemoryUsage())
+    struct MemoryUsage
+    {
+        std::size_t source_text;    ///< Исходный текст
+        std::size_t key_positions;  ///< Местоположения ключей и построенные по ним индексы и хэши
+        std::size_t items;          ///< Узлы и их векторы ссылок на тексты и дочерние узлы
+        std::size_t texts;          ///< Текстовые отрывки в TextPool
+        std::size_t total;          ///< Сумма всех составляющих
+    };
+
+    // Константы:
+    /** Наибольшее количество местоположений ключей (узлов дерева без коренного)
+     * @details Номера местоположений, номера узлов в прямом порядке обхода и номера элементов TokenStream
+     *  (по два на ключ) хранятся 32-битными. Тексты с большим количеством ключей не разбираются
+     *  (ошибка "Too many keys"), поддеревья, после вставки которых узлов стало бы больше, не вставляются
+     */
+    static const unsigned int MAX_KEY_POSITIONS = 0x7FFFFFFF;
+
 private:
     // Данные:
-    std::string rude_text;          ///< Исходный текст
-    std::vector<KeyPositionType> key_positions;  ///< Вектор местоположений ключей
+    /** Исходные данные: текст, местоположения ключей, множество ключей, параметры, тексты узлов
+     * @details Находятся в куче, поэтому перемещение дерева не затрагивает узлы.
+     *  Общие с поддеревьями, отделёнными detachSubtree()
+     */
+    std::shared_ptr<ParserTreeSource> source;
+    std::vector<std::shared_ptr<ParserTreeSource>> spliced_sources; ///< Исходные данные поддеревьев, вставленных spliceSubtree()
     ParserTreeItem* root_item;      ///< Коренной узел дерева
-    std::set<KeyType> keys;         ///< Множество ключей
     std::string error_description;  ///< Описание текущих ошибок
     std::vector<ParserTreeItem*> last_find;  ///< Результат посдеднего поиска ключей (узлов)
+    mutable std::vector<std::vector<unsigned int>> tag_index;   ///< Номера узлов (в прямом порядке обхода) по идентификаторам ключей
+    mutable std::vector<unsigned long long> content_hashes;     ///< Хэши содержимого узлов по номерам в прямом порядке обхода
+    /** Узлы, хэши которых вычисляются заново при updateIndices()
+     * @details Родители мест detachSubtree() и spliceSubtree() и их предки; хэши остальных узлов переносятся
+     */
+    mutable std::unordered_set<const ParserTreeItem*> dirty_items;
+    /// Известные хэши узлов, перенесённых из другого дерева detachSubtree() и spliceSubtree() (до updateIndices())
+    mutable std::unordered_map<const ParserTreeItem*, unsigned long long> carried_hashes;
+    mutable TextIndex text_index;   ///< Слова собственных текстов узлов (по номерам в прямом порядке обхода)
+    /** text_index соответствует узлам
+     * @details Сбрасывается вместе с indices_valid, индекс строится при первом поиске по тексту (под indices_mutex)
+     */
+    mutable std::atomic<bool> text_index_valid;
+    /** Узлы соответствуют местоположениям ключей source
+     * @details Устанавливается createTree(), сбрасывается при detachSubtree() и spliceSubtree(). Пока установлен,
+     *  номер узла в прямом порядке обхода равен номеру местоположения + 1 и индексы строятся без обхода узлов
+     */
+    bool items_match_source;
+    /** Нумерация узлов, tag_index и content_hashes соответствуют узлам
+     * @details Сбрасывается при detachSubtree() и spliceSubtree(), восстанавливается updateIndices()
+     */
+    mutable std::atomic<bool> indices_valid;
+    std::unique_ptr<std::mutex> indices_mutex;  ///< Защита перестроения индексов (и построения text_index)
 
 public:
     // Создать / уничтожить дерево:
     /** Конструктор
+     * @param text - исходный текст (передаётся по значению: временную строку можно переместить без копирования)
+     * @param parse_options - параметры разбора
+     */
+    explicit ParserTree(std::string text, const ParseOptions& parse_options = ParseOptions());
+
+    /** Конструктор с готовым множеством ключей
+     * @details Список ключей не считывается с файла Key_list_filename
      * @param text - исходный текст
+     * @param key_set - множество ключей
+     * @param parse_options - параметры разбора
+     */
+    ParserTree(std::string text, const KeySet& key_set, const ParseOptions& parse_options = ParseOptions());
+
+    /** Конструктор перемещения
+     * @details Узлы и исходные данные не копируются. Перемещённое дерево можно только уничтожить или присвоить
+     * @param tree - перемещаемое дерево
+     */
+    ParserTree(ParserTree&& tree);
+
+    /** Перемещающее присваивание
+     * @param tree - перемещаемое дерево
+     * @return Вызывающий объект
      */
-    explicit ParserTree(const std::string& text);
+    ParserTree& operator=(ParserTree&& tree);
+
+    ParserTree(const ParserTree&) = delete;
+    ParserTree& operator=(const ParserTree&) = delete;
 
     /** Сконструировать дерево
+     * @details Не строится для текстов длиннее KeyPositionType::MAX_POSITION, с количеством ключей больше
+     *  MAX_KEY_POSITIONS или с количеством слов в собственных текстах узла больше TextIndex::MAX_WORD_NUM
+     *  (при ParseOptions::text_index). Выполняется один раз: повторный вызов, в том числе для дерева из
+     *  detachSubtree() или после spliceSubtree(), завершается ошибкой "Tree is already created"
      * @return Удалось ли создать дерево
      * @note В случае неудачи конструирования дерева причину ошибки можно узнать при помощи getErrorDescription()
      */
@@ -380,33 +1512,258 @@ public:
     bool readKeysFromFile(std::ifstream &fin);
 
     /** Поиск ключа
+     * @details Находит все узлы ключа по индексу ключей, результат - getLastFind()
      * @param key - ключ, который необходимо найти
      * @return Вызывающий объект
      */
     ParserTree& find(const KeyType& key);
 
+    /** Поиск ключа без сохранения результата
+     * @details Как find(), но не изменяет дерево: годится для общих деревьев (ParserCache) и нескольких потоков
+     * @param [in] key - ключ, который необходимо найти
+     * @return узлы ключа в прямом порядке обхода
+     */
+    std::vector<ParserTreeItem*> findItems(const KeyType& key) const;
+
+    /** Поиск ключа внутри результата последнего поиска
+     * @details Оставляет в getLastFind() узлы ключа, вложенные в найденные ранее:
+     *  tree.find(KeyType("<table> </table>")).findNested(KeyType("<a> </a>")) - все ссылки в таблицах.
+     *  Для каждого найденного ранее узла просматривается только отрезок индекса внутри его поддерева
+     * @param key - ключ, который необходимо найти
+     * @return Вызывающий объект
+     */
+    ParserTree& findNested(const KeyType& key);
+
+    /** Поиск ключа внутри заданных узлов без сохранения результата
+     * @details Как findNested(), но предки передаются явно и дерево не изменяется
+     * @param [in] ancestors - узлы дерева
+     * @param [in] key - ключ, который необходимо найти
+     * @return узлы ключа, вложенные в ancestors, в прямом порядке обхода
+     */
+    std::vector<ParserTreeItem*> findNestedItems(const std::vector<ParserTreeItem*>& ancestors, const KeyType& key) const;
+
+    /** Поиск узлов по тексту
+     * @details Находит узлы, собственные тексты которых (без текстов потомков) содержат слово или фразу,
+     *  результат - getLastFind() в порядке документа. Слова сравниваются после нормализации (см. splitWords()):
+     *  findText("Продажа квартир") находит "продажа&nbsp;квартир". Использует инвертированный индекс
+     *  (ParseOptions::text_index), время поиска зависит от числа вхождений слов, а не от размера текста.
+     *  Если индекс не строился при разборе, он строится по местоположениям ключей (узлы отложенного дерева
+     *  не строятся), а после detachSubtree() и spliceSubtree() - по текстам узлов. Если слов в текстах узла
+     *  больше TextIndex::MAX_WORD_NUM, индекс не строится: результат пуст, причина - в getErrorDescription()
+     * @param [in] phrase - слово или несколько слов
+     * @return Вызывающий объект
+     */
+    ParserTree& findText(const std::string& phrase);
+
+    /** Поиск узлов по тексту без сохранения результата
+     * @details Как findText(), но не изменяет дерево (индекс слов строится потокобезопасно). Если индекс
+     *  не удалось построить (слишком много слов в текстах узла), результат пуст
+     * @param [in] phrase - слово или несколько слов
+     * @return узлы в порядке документа
+     */
+    std::vector<ParserTreeItem*> findTextItems(const std::string& phrase) const;
+
+    /** Потомки узла с заданным ключом
+     * @param [in] ancestor - узел дерева
+     * @param [in] tag_id - идентификатор ключа
+     * @return потомки узла с ключом tag_id в прямом порядке обхода
+     */
+    std::vector<ParserTreeItem*> findDescendants(const ParserTreeItem& ancestor, TagId tag_id) const;
+
+    /** Узел по номеру в прямом порядке обхода
+     * @details Спуск от корня с двоичным поиском среди дочерних узлов
+     * @param [in] pre_order - номер узла
+     * @return узел или nullptr, если номера нет в дереве
+     */
+    ParserTreeItem* findItemByPreOrder(unsigned int pre_order) const;
+
+    /** Хэш содержимого узла
+     * @details Вычисляется при создании дерева от листьев к корню по имени тега, текстам
+     *  и хэшам дочерних узлов. Одинаковые поддеревья имеют одинаковые хэши
+     * @param [in] item - узел дерева
+     * @return хэш поддерева узла
+     */
+    unsigned long long getContentHash(const ParserTreeItem& item) const;
+
+    /** Сравнение с новой версией дерева
+     * @details Поддеревья с одинаковыми хэшами пропускаются, поэтому время сравнения
+     *  зависит от размера изменений, а не от размера деревьев
+     * @param [in] new_tree - новое дерево (createTree() должен быть выполнен для обоих деревьев)
+     * @return вставленные, удалённые и изменённые узлы
+     */
+    std::vector<TreeDifference> diff(const ParserTree& new_tree) const;
+
+    /** Отделение поддерева
+     * @details Узел вместе с потомками переносится в новое дерево без копирования: он становится единственным
+     *  дочерним узлом нового коренного. Новое дерево разделяет исходные данные с текущим.
+     *  Обходятся только узлы поддерева (ряды и известные хэши переносятся в новое дерево); номера узлов обоих
+     *  деревьев обновляются при updateIndices()
+     * @param [in] item - узел дерева (кроме коренного)
+     * @param [out] p_slot - место, освобождённое узлом: вставка spliceSubtree() в это место восстанавливает дерево
+     * @return отделённое поддерево (при ошибке - пустое дерево с описанием в getErrorDescription())
+     */
+    ParserTree detachSubtree(const ParserTreeItem& item, ItemSlot* p_slot = nullptr);
+
+    /** Вставка поддерева
+     * @details Тексты и дочерние узлы коренного узла tree переносятся без копирования в узел parent
+     *  сразу перед его дочерним узлом child_num (после всех текстов, предшествующих этому узлу).
+     *  Чтобы вернуть поддерево на место, освобождённое detachSubtree(), используется spliceSubtree(slot, tree). Исходные данные tree сохраняются, пока существует текущее дерево.
+     *  Обходятся только вставляемые узлы (ряды и хэши); номера узлов обновляются при updateIndices()
+     * @param [in] parent - узел дерева
+     * @param [in] child_num - номер дочернего узла, перед которым выполняется вставка (количество дочерних - в конец)
+     * @param [in] tree - вставляемое дерево, после вставки можно только уничтожить или присвоить
+     * @return выполнена ли вставка
+     */
+    bool spliceSubtree(const ParserTreeItem& parent, unsigned int child_num, ParserTree&& tree);
+
+    /** Вставка поддерева в место последовательности вхождений
+     * @details Как spliceSubtree(parent, child_num, tree), но место задаётся среди текстов и дочерних узлов:
+     *  поддерево, отделённое detachSubtree(), возвращается между теми же текстами
+     * @param [in] slot - место вставки (номер в последовательности не больше её длины)
+     * @param [in] tree - вставляемое дерево, после вставки можно только уничтожить или присвоить
+     * @return выполнена ли вставка
+     */
+    bool spliceSubtree(const ItemSlot& slot, ParserTree&& tree);
+
+    /** Обновление номеров узлов и индексов после detachSubtree() и spliceSubtree()
+     * @details Перенумеровывает узлы (номер в прямом порядке обхода, граница поддерева) и перестраивает индекс
+     *  ключей. Хэши содержимого вычисляются заново только для родителей мест изменения и их предков, хэши
+     *  остальных узлов переносятся (ряды и колонны обновляются сразу при изменении). Выполняется автоматически
+     *  при поиске, сравнении и выводе дерева. Строит все отложенные узлы. Для неизменённого дерева ничего не делает
+     */
+    void updateIndices() const;
+
+    /** Чтение результата последнего поиска
+     * @return узлы, найденные find() или findNested()
+     */
+    const std::vector<ParserTreeItem*>& getLastFind() const;
+
     /** Вывод дерева через интерфейс ASCII
-     * @return строка с деревом в ASCII представление
+     * @details Отмена через control проверяется перед выводом каждого узла (вывод большого дерева в потоке
+     *  разбора можно прервать так же, как разбор)
+     * @param [in] control - управление выводом (nullptr - без отмены)
+     * @return строка с деревом в ASCII представление (пустая строка при отмене)
+     */
+    std::string outASCIITree(const ParseControl* control = nullptr) const;
+
+    /** Декодированный текст поддерева
+     * @details Объединяет декодированные тексты всех узлов поддерева в порядке их следования в исходном тексте.
+     *  Память под результат выделяется один раз
+     * @param [in] subtree - корень поддерева
+     * @return декодированный текст поддерева
      */
-    std::string outASCIITree() const;
+    std::string decodedText(const ParserTreeItem& subtree) const;
+
+
+    /** Чтение ключа узла
+     * @details Ключ берётся из множества ключей исходных данных узла (у вставленных поддеревьев оно может отличаться)
+     * @param [in] item - узел дерева
+     * @return ключ узла
+     */
+    const KeyType& getKey(const ParserTreeItem& item) const;
+
+    /** Чтение текста ключа узла
+     * @details Для узла, созданного ключом "<div> </div>", это текст вида "<div class=\"top\">"
+     * @param [in] item - узел дерева
+     * @return текст начала ключевой области узла (пустая строка для корневого узла)
+     */
+    std::string getItemKeyText(const ParserTreeItem& item) const;
+
+    /** Строка и колонка позиции в исходном тексте
+     * @details Двоичный поиск по индексу начал строк за O(log n). Индекс строится один раз (потокобезопасно):
+     *  при разборе с ParseOptions::line_index или при первом вызове
+     * @param [in] offset - позиция в исходном тексте
+     * @return строка и колонка позиции
+     */
+    LineColumn lineColumn(std::size_t offset) const;
+
+    /** Строка и колонка начала ключевой области узла
+     * @details Позиция берётся в исходном тексте узла (у вставленных поддеревьев он свой)
+     * @param [in] item - узел дерева
+     * @return строка и колонка начала узла (1:1 для корневого узла)
+     */
+    LineColumn getItemLineColumn(const ParserTreeItem& item) const;
 
 
     // Чтение полей класса:
     /** Чтение исходного текста
+     * @details У поддерева, отделённого detachSubtree(), - весь текст исходного дерева
      * @return исходный текст
      */
     const std::string& getRudeText() const;
 
+    /** Чтение коренного узла дерева
+     * @return коренной узел дерева
+     */
+    const ParserTreeItem& getRootItem() const;
+
     /** Чтение текущих ошибок
      * @return список установленных ошибок
      */
     const std::string& getErrorDescription() const;
 
+    /** Чтение параметров разбора
+     * @return параметры разбора
+     */
+    const ParseOptions& getParseOptions() const;
+
+    /** Чтение хранилища текстовых отрывков
+     * @return хранилище текстовых отрывков узлов
+     */
+    const TextPool& getTextPool() const;
+
+    /** Чтение множества ключей
+     * @return множество ключей
+     */
+    const KeySet& getKeySet() const;
+
+    /** Чтение вектора местоположений ключей
+     * @details Вектор заполняется в конструкторе и отсортирован по началу зоны действия ключей.
+     *  Для получения позиций ключей без построения дерева достаточно не вызывать createTree() (см. TokenStream)
+     * @return вектор местоположений ключей
+     */
+    const std::vector<KeyPositionType>& getKeyPositions() const;
+
+    /** Оценка памяти дерева
+     * @details Учитываются выделенные буферы векторов и строк; служебные данные распределителя памяти не учитываются
+     * @return объём памяти по составляющим дерева
+     */
+    MemoryUsage getMemoryUsage() const;
+
+    /** Установка обработчика роста памяти дерева
+     * @details Вызывается с приростом оценки памяти (см. getMemoryUsage()) после построения данных отложенного
+     *  узла и после построения индекса строк или индекса слов при первом обращении. Вызывается в обратившемся
+     *  потоке вне блокировок дерева. Устанавливается до передачи дерева другим потокам (см. ParserCache)
+     * @param [in] callback - обработчик (пустой - без обработчика)
+     */
+    void setMemoryGrowthCallback(std::function<void(std::size_t)> callback);
+
 protected:
     // TODO: Зодокументировать
     // Вспомогательные методы:
-    bool findAllKeyPosition(const std::string& s);    
-    void SubTree(unsigned int begin_rude_text_pos, unsigned int end_rude_text_position,
-                  unsigned int &vector_pos, ParserTreeItem& item);
+    ParserTree(const std::shared_ptr<ParserTreeSource>& tree_source,
+               const std::vector<std::shared_ptr<ParserTreeSource>>& tree_spliced_sources);
+    void parseText();
+    bool findAllKeyPosition(const std::string& s);
+    std::size_t keyPositionsBytes() const;
+    bool buildTextIndex() const;
+    bool indexSourceTexts() const;
+    bool indexItemTexts() const;
+    std::string describePosition(std::size_t offset) const;
+    bool isMemoryBudgetExceeded(std::size_t bytes) const;
+    void deleteItems();
+    void releaseTree();
+    void findSubtreeEnds();
+    void computeContentHashes();
+    void diffItems(const ParserTreeItem& old_item, const ParserTree& new_tree, const ParserTreeItem& new_item,
+                   std::vector<TreeDifference>& differences) const;
+    const std::string& getItemTagName(const ParserTreeItem& item) const;
+    bool containsItem(const ParserTreeItem& item) const;
+    void insertSubtree(ParserTreeItem& parent, unsigned int sequence_pos, ParserTree&& tree);
+    void invalidateIndices();
+    void markDirty(const ParserTreeItem& item);
+    bool findKnownHash(const ParserTreeItem& item, unsigned long long& hash) const;
+
+    friend class ParserTreeItem;
 };
 #endif // PARSER_H
@@ -0,0 +1,228 @@
+#include "parser_cache.h"
+
+/** Оценка памяти дерева
+ * @param [in] tree - дерево
+ * @return приблизительное количество байт, занимаемых деревом (см. ParserTree::getMemoryUsage())
+ */
+static std::size_t estimateTreeBytes(const ParserTree& tree);
+
+/** Хэш параметров разбора
+ * @param [in] parse_options - параметры разбора
+ * @return хэш параметров, влияющих на содержимое и индексы дерева
+ *  (control не учитывается: он влияет только на ошибочные деревья, которые не сохраняются)
+ */
+static unsigned long long hashParseOptions(const ParserTree::ParseOptions& parse_options);
+
+//=================================================================
+
+/* === ParserCache === */
+// Конструктор:
+ParserCache::ParserCache(std::size_t budget) : byte_budget(budget), growth_account(std::make_shared<GrowthAccount>())
+{
+    statistics = {};
+    growth_account->cache = this;
+}
+
+// Деструктор:
+ParserCache::~ParserCache()
+{
+    /* Обработчики роста памяти выданных деревьев больше не обращаются к кэшу */
+    std::lock_guard<std::mutex> lock(growth_account->mutex);
+    growth_account->cache = nullptr;
+}
+
+
+// Получить дерево:
+std::shared_ptr<const ParserTree> ParserCache::getTree(const std::string& text, const KeySet& key_set,
+                                                       const ParserTree::ParseOptions& parse_options)
+{
+    CacheKey key = { hashBytes(text.data(), text.size()), key_set.getId(), hashParseOptions(parse_options), text.size() };
+
+    /* Поиск в кэше и среди разбираемых другими потоками текстов */
+    std::shared_ptr<std::promise<std::shared_ptr<const ParserTree>>> parse_promise;
+    PendingTree pending_tree;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entry_index.find(key);
+        /* Совпадение хэшей проверяем сравнением текстов */
+        if (it != entry_index.end() && it->second->tree->getRudeText() == text)
+        {
+            statistics.hits++;
+            return touch(it->second);
+        }
+        auto pending_it = pending_trees.find(key);
+        if (pending_it != pending_trees.end())
+            pending_tree = pending_it->second;
+        else
+        {
+            statistics.misses++;
+            parse_promise = std::make_shared<std::promise<std::shared_ptr<const ParserTree>>>();
+            pending_trees[key] = parse_promise->get_future().share();
+        }
+    }
+
+    /* Текст уже разбирается: ждём дерево. Если разбор не удался (например, отменён через control
+     *   другого вызова) или тексты различаются при равных хэшах, разбираем сами */
+    if (pending_tree.valid())
+    {
+        std::shared_ptr<const ParserTree> tree = pending_tree.get();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tree->getErrorDescription().empty() && tree->getRudeText() == text)
+        {
+            statistics.hits++;
+            return tree;
+        }
+        statistics.misses++;
+    }
+
+    /* Разбор без блокировки: другие потоки в это время могут пользоваться кэшем */
+    std::shared_ptr<ParserTree> tree;
+    try
+    {
+        tree = std::make_shared<ParserTree>(text, key_set, parse_options);
+        tree->createTree();
+    }
+    catch (...)
+    {
+        if (parse_promise)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending_trees.erase(key);
+            }
+            parse_promise->set_exception(std::current_exception());
+        }
+        throw;
+    }
+
+    /* Ошибочные деревья (в том числе отменённый разбор и превышение бюджета памяти) не сохраняются:
+     *   следующий вызов разберёт текст заново */
+    std::size_t bytes = 0;
+    if (tree->getErrorDescription().empty())
+    {
+        /* Рост памяти дерева после добавления в кэш учитывается сразу */
+        std::shared_ptr<GrowthAccount> account = growth_account;
+        const ParserTree* p_tree = tree.get();
+        tree->setMemoryGrowthCallback([account, key, p_tree](std::size_t growth_bytes)
+        {
+            std::lock_guard<std::mutex> lock(account->mutex);
+            if (account->cache != nullptr)
+                account->cache->addGrowth(key, p_tree, growth_bytes);
+        });
+        bytes = estimateTreeBytes(*tree);
+    }
+
+    std::shared_ptr<const ParserTree> result = tree;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (parse_promise)
+            pending_trees.erase(key);
+        if (tree->getErrorDescription().empty())
+        {
+            auto it = entry_index.find(key);
+            if (it != entry_index.end() && it->second->tree->getRudeText() == text)
+                result = touch(it->second);     // Тот же текст уже разобран другим потоком
+            else
+            {
+                if (it != entry_index.end())
+                {
+                    /* Коллизия хэшей: заменяем старое дерево */
+                    statistics.bytes -= it->second->bytes;
+                    entries.erase(it->second);
+                    entry_index.erase(it);
+                }
+                CacheEntry entry = { key, tree, bytes };
+                entries.push_front(entry);
+                entry_index[key] = entries.begin();
+                statistics.bytes += bytes;
+                evict();
+            }
+        }
+    }
+    if (parse_promise)
+        parse_promise->set_value(result);
+    return result;
+}
+
+
+// Установить бюджет памяти:
+void ParserCache::setByteBudget(std::size_t budget)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    byte_budget = budget;
+    evict();
+}
+
+// Очистить кэш:
+void ParserCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    entry_index.clear();
+    statistics.bytes = 0;
+}
+
+// Статистика:
+ParserCache::Statistics ParserCache::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Statistics result = statistics;
+    result.entries = entries.size();
+    return result;
+}
+
+
+// Отметить использование дерева (mutex захвачен):
+std::shared_ptr<const ParserTree> ParserCache::touch(EntryList::iterator entry)
+{
+    entries.splice(entries.begin(), entries, entry);
+    return entry->tree;
+}
+
+// Учесть рост памяти дерева (вызывается обработчиком роста памяти дерева):
+void ParserCache::addGrowth(const CacheKey& key, const ParserTree* p_tree, std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entry_index.find(key);
+    /* Дерево могло быть удалено из кэша или заменено */
+    if (it == entry_index.end() || it->second->tree.get() != p_tree)
+        return;
+    it->second->bytes += bytes;
+    statistics.bytes += bytes;
+    evict();
+}
+
+
+// Удалить давно не использованные деревья сверх бюджета (mutex захвачен):
+void ParserCache::evict()
+{
+    while (statistics.bytes > byte_budget && !entries.empty())
+    {
+        statistics.bytes -= entries.back().bytes;
+        entry_index.erase(entries.back().key);
+        entries.pop_back();
+        statistics.evictions++;
+    }
+}
+
+
+//=================================================================
+
+/* === Other funtion === */
+std::size_t estimateTreeBytes(const ParserTree& tree)
+{
+    return sizeof(ParserTree) + tree.getMemoryUsage().total;
+}
+
+unsigned long long hashParseOptions(const ParserTree::ParseOptions& parse_options)
+{
+    const unsigned long long values[] = {
+        static_cast<unsigned long long>(parse_options.whitespace_mode),
+        parse_options.intern_texts ? parse_options.max_interned_text_length + 1ULL : 0ULL,
+        parse_options.lazy_tree ? 1ULL : 0ULL,
+        static_cast<unsigned long long>(parse_options.memory_budget),
+        parse_options.line_index ? 1ULL : 0ULL,
+        parse_options.text_index ? 1ULL : 0ULL
+    };
+    return hashBytes(reinterpret_cast<const char*>(values), sizeof(values));
+}
@@ -0,0 +1,135 @@
+#ifndef PARSER_CACHE_H
+#define PARSER_CACHE_H
+
+#include "parser.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <unordered_map>
+
+/// Кэш разобранных деревьев по содержимому текста
+/** @details Дерево ищется по хэшу текста, идентификатору множества ключей и параметрам разбора.
+ *  Возвращаемые деревья общие и неизменяемые: createTree() для них уже выполнен, поиск - через
+ *  ParserTree::findItems(), findNestedItems() и findTextItems().
+ *  При превышении бюджета памяти удаляются давно не использованные деревья. Память дерева оценивается
+ *  при добавлении, а рост памяти (узлы отложенного дерева, индексы, построенные при первом обращении)
+ *  учитывается сразу через ParserTree::setMemoryGrowthCallback().
+ *  Один и тот же текст разбирается один раз: потоки, запросившие его во время разбора, ждут результата.
+ *  Все методы потокобезопасны
+ */
+class ParserCache {
+public:
+    // Новые типы данных:
+    /// Статистика кэша
+    struct Statistics
+    {
+        unsigned long long hits;            ///< Найдено в кэше
+        unsigned long long misses;          ///< Разобрано заново
+        unsigned long long evictions;       ///< Удалено из-за бюджета памяти
+        std::size_t entries;                ///< Деревьев в кэше
+        std::size_t bytes;                  ///< Оценка памяти деревьев в кэше
+    };
+
+private:
+    /// Ключ кэша
+    struct CacheKey
+    {
+        unsigned long long text_hash;       ///< Хэш текста
+        unsigned long long key_set_id;      ///< Идентификатор множества ключей
+        unsigned long long options_hash;    ///< Хэш параметров разбора
+        std::size_t text_size;              ///< Длина текста
+
+        bool operator==(const CacheKey& key) const
+        {
+            return text_hash == key.text_hash && key_set_id == key.key_set_id
+                    && options_hash == key.options_hash && text_size == key.text_size;
+        }
+    };
+    struct CacheKeyHash
+    {
+        std::size_t operator()(const CacheKey& key) const
+        {
+            return static_cast<std::size_t>(key.text_hash ^ (key.key_set_id * 31) ^ (key.options_hash * 131));
+        }
+    };
+    /// Элемент кэша
+    struct CacheEntry
+    {
+        CacheKey key;
+        std::shared_ptr<const ParserTree> tree;
+        std::size_t bytes;
+    };
+    typedef std::list<CacheEntry> EntryList;
+    /// Результат разбора, которого ждут другие потоки
+    typedef std::shared_future<std::shared_ptr<const ParserTree>> PendingTree;
+    /** Учёт роста памяти деревьев
+     * @details Общий для кэша и обработчиков роста памяти его деревьев: деревья могут пережить кэш,
+     *  поэтому при уничтожении кэша указатель на него обнуляется
+     */
+    struct GrowthAccount
+    {
+        std::mutex mutex;                   ///< Защита указателя (захватывается раньше mutex кэша)
+        ParserCache* cache;                 ///< Кэш (nullptr после его уничтожения)
+    };
+
+    // Данные:
+    std::size_t byte_budget;                ///< Бюджет памяти
+    EntryList entries;                      ///< Элементы, от недавно использованных к давно не использованным
+    std::unordered_map<CacheKey, EntryList::iterator, CacheKeyHash> entry_index;  ///< Элементы по ключам
+    std::unordered_map<CacheKey, PendingTree, CacheKeyHash> pending_trees;      ///< Разбираемые сейчас тексты
+    Statistics statistics;                  ///< Статистика
+    mutable std::mutex mutex;               ///< Защита всех данных
+    std::shared_ptr<GrowthAccount> growth_account;  ///< Учёт роста памяти деревьев
+
+public:
+    /** Конструктор
+     * @param [in] budget - бюджет памяти в байтах
+     */
+    explicit ParserCache(std::size_t budget);
+
+    /** Деструктор
+     * @details Выданные деревья остаются действительными, их рост памяти больше не учитывается
+     */
+    ~ParserCache();
+
+    ParserCache(const ParserCache&) = delete;
+    ParserCache& operator=(const ParserCache&) = delete;
+
+    /** Получение дерева
+     * @details Если дерево для такого же текста, множества ключей и параметров уже есть в кэше,
+     *  возвращается оно; иначе текст разбирается (вне блокировки кэша) и дерево добавляется в кэш.
+     *  Если такой же текст уже разбирается другим потоком, вызов ждёт его результата (ParseOptions::control
+     *  вызова во время ожидания не проверяется). Дерево с ошибкой разбора (в том числе отменённого через
+     *  ParseOptions::control) в кэш не добавляется, ждавшие его потоки разбирают текст сами
+     * @param [in] text - исходный текст
+     * @param [in] key_set - множество ключей
+     * @param [in] parse_options - параметры разбора
+     * @return общее дерево (при ошибке разбора её описание в getErrorDescription() дерева)
+     */
+    std::shared_ptr<const ParserTree> getTree(const std::string& text, const KeySet& key_set,
+                                              const ParserTree::ParseOptions& parse_options = ParserTree::ParseOptions());
+
+    /** Установка бюджета памяти
+     * @details Лишние деревья сразу удаляются из кэша
+     * @param [in] budget - бюджет памяти в байтах
+     */
+    void setByteBudget(std::size_t budget);
+
+    /** Очистка кэша
+     * @details Статистика попаданий сохраняется
+     */
+    void clear();
+
+    /** Чтение статистики
+     * @return статистика кэша
+     */
+    Statistics getStatistics() const;
+
+private:
+    std::shared_ptr<const ParserTree> touch(EntryList::iterator entry);
+    void addGrowth(const CacheKey& key, const ParserTree* p_tree, std::size_t bytes);
+    void evict();
+};
+
+#endif // PARSER_CACHE_H
@@ -6,7 +6,7 @@
 
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 TARGET = parser_test
 TEMPLATE = app
@@ -15,10 +15,17 @@ TEMPLATE = app
 SOURCES += main.cpp\
         parsertest.cpp \
     parser.cpp \
-    search_functions.cpp
+    search_functions.cpp \
+    text_functions.cpp \
+    token_stream.cpp \
+    tag_scanner.cpp \
+    parser_cache.cpp \
+    parsertreemodel.cpp
 
 HEADERS  += parsertest.h \
-    parser.h
+    parser.h \
+    parser_cache.h \
+    parsertreemodel.h
 
 FORMS    += parsertest.ui
 
@@ -1,21 +1,38 @@
 #include "parsertest.h"
 #include "ui_parsertest.h"
 #include "parser.h"
+#include "parsertreemodel.h"
 #include <QFile>
 #include <QTextStream>
+#include <QtConcurrent/QtConcurrentRun>
+
+/** Разбор текста (выполняется в потоке разбора)
+ * @details Дерево отложенное: узлы строятся при раскрытии их родителей в QTreeView
+ * @param [in] text - исходный текст
+ * @param [in] control - управление разбором
+ * @return дерево или описание ошибки
+ */
+static parsertest::ParseResult buildTree(const std::string& text, ParseControl* control);
 
 parsertest::parsertest(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::parsertest)
+    ui(new Ui::parsertest),
+    tree_model(nullptr)
 {
     ui->setupUi(this);
 
+    connect(&parse_watcher, &QFutureWatcher<ParseResult>::finished, this, &parsertest::showTree);
+    connect(&progress_timer, &QTimer::timeout, this, &parsertest::updateProgress);
+    connect(ui->parseButton, &QPushButton::clicked, this, &parsertest::loadTree);
+
     loadTextFile();
     loadTree();
 }
 
 parsertest::~parsertest()
 {
+    /* Поток разбора не обращается к окну: достаточно отменить разбор, не дожидаясь его */
+    cancelParsing();
     delete ui;
 }
 
@@ -33,18 +50,78 @@ void parsertest::loadTextFile()
 
 void parsertest::loadTree()
 {
-     /* Считываем строку с fileEdit в tree */
-     QString inputText(ui->fileEdit->toPlainText());
-     std::string inputTextStdString = inputText.toStdString();
-     ParserTree tree(inputTextStdString);
+     /* Предыдущий разбор больше не нужен */
+     cancelParsing();
 
-     /* Создаем дерево и показываем его */
-     if (tree.createTree())
+     /* Разбираем строку с fileEdit в потоке разбора, окно остаётся отзывчивым */
+     std::string inputTextStdString = ui->fileEdit->toPlainText().toStdString();
+     std::shared_ptr<ParseControl> control = std::make_shared<ParseControl>();
+     parse_control = control;
+     parse_watcher.setFuture(QtConcurrent::run([inputTextStdString, control]()
      {
-         QString outText = QString::fromStdString(tree.outASCIITree());
-         ui->parserEdit->setPlainText(outText);
-     }
-     else
-         ui->parserEdit->setPlainText("Error: can\'t create tree:\n" + QString::fromStdString(tree.getErrorDescription()));
+         return buildTree(inputTextStdString, control.get());
+     }));
+
+     setTreeModel(nullptr);
+     ui->progressBar->setValue(0);
+     ui->statusBar->showMessage("Parsing...");
+     progress_timer.start(50);
+}
+
+void parsertest::cancelParsing()
+{
+    if (parse_control)
+        parse_control->cancel();
+    progress_timer.stop();
+}
+
+void parsertest::updateProgress()
+{
+    std::size_t bytes_total = parse_control->getBytesTotal();
+    if (bytes_total != 0)
+        ui->progressBar->setValue(static_cast<int>(ui->progressBar->maximum() * (double)parse_control->getBytesScanned() / bytes_total));
+}
+
+void parsertest::showTree()
+{
+    progress_timer.stop();
+    ParseResult result = parse_watcher.result();
+    if (result.cancelled)
+        return;
+
+    /* Показываем дерево: модель формирует только видимые строки */
+    ui->progressBar->setValue(ui->progressBar->maximum());
+    if (result.tree)
+    {
+        setTreeModel(new ParserTreeModel(result.tree, this));
+        ui->statusBar->clearMessage();
+    }
+    else
+        ui->statusBar->showMessage("Error: can\'t create tree: " + result.error.simplified());
+}
+
+void parsertest::setTreeModel(ParserTreeModel* model)
+{
+    ParserTreeModel* old_model = tree_model;
+    tree_model = model;
+    ui->treeView->setModel(tree_model);
+    delete old_model;
 }
 
+
+parsertest::ParseResult buildTree(const std::string& text, ParseControl* control)
+{
+    ParserTree::ParseOptions options;
+    options.control = control;
+    options.lazy_tree = true;
+    std::shared_ptr<ParserTree> tree = std::make_shared<ParserTree>(text, options);
+
+    /* Создаем дерево */
+    parsertest::ParseResult result = { false, nullptr, QString() };
+    if (tree->createTree())
+        result.tree = tree;
+    else
+        result.error = QString::fromStdString(tree->getErrorDescription());
+    result.cancelled = control->isCancelled();
+    return result;
+}
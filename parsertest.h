@@ -2,6 +2,13 @@
 #define PARSERTEST_H
 
 #include <QMainWindow>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <memory>
+
+class ParseControl;
+class ParserTree;
+class ParserTreeModel;
 
 namespace Ui {
 class parsertest;
@@ -12,13 +19,30 @@ class parsertest : public QMainWindow
     Q_OBJECT
 
 public:
+    /// Результат фонового разбора
+    struct ParseResult
+    {
+        bool cancelled;                         ///< Разбор отменён, результат не показывается
+        std::shared_ptr<const ParserTree> tree; ///< Отложенное дерево (nullptr при ошибке)
+        QString error;                          ///< Описание ошибки
+    };
+
     explicit parsertest(QWidget *parent = 0);
     ~parsertest();
 
 private:
     Ui::parsertest *ui;
+    QFutureWatcher<ParseResult> parse_watcher;      ///< Ожидание текущего разбора
+    std::shared_ptr<ParseControl> parse_control;    ///< Управление текущим разбором (общее с потоком разбора)
+    QTimer progress_timer;                          ///< Обновление индикатора выполнения
+    ParserTreeModel* tree_model;                    ///< Модель показываемого дерева
+
     void loadTextFile();
     void loadTree();
+    void cancelParsing();
+    void updateProgress();
+    void showTree();
+    void setTreeModel(ParserTreeModel* model);
 };
 
 #endif // PARSERTEST_H
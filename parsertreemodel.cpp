@@ -0,0 +1,115 @@
+#include "parsertreemodel.h"
+#include "parser.h"
+
+/// Количество дочерних узлов, добавляемых в модель за один fetchMore()
+static const int Fetch_batch_size = 256;
+
+/// Максимальная длина текста в колонке TEXT_COLUMN
+static const int Max_display_text_length = 200;
+
+ParserTreeModel::ParserTreeModel(std::shared_ptr<const ParserTree> parser_tree, QObject *parent) :
+    QAbstractItemModel(parent),
+    tree(parser_tree)
+{
+}
+
+const ParserTreeItem* ParserTreeModel::itemFromIndex(const QModelIndex &index) const
+{
+    if (index.isValid())
+        return static_cast<const ParserTreeItem*>(index.internalPointer());
+    return &tree->getRootItem();
+}
+
+QModelIndex ParserTreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (row < 0 || column < 0 || column >= COLUMN_COUNT || row >= rowCount(parent))
+        return QModelIndex();
+    const ParserTreeItem* p_item = itemFromIndex(parent)->getChilds()[row];
+    return createIndex(row, column, const_cast<ParserTreeItem*>(p_item));
+}
+
+QModelIndex ParserTreeModel::parent(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return QModelIndex();
+    const ParserTreeItem* p_parent = itemFromIndex(index)->getParent();
+    if (p_parent == nullptr || p_parent == &tree->getRootItem())
+        return QModelIndex();
+    return createIndex(p_parent->getColumn(), 0, const_cast<ParserTreeItem*>(p_parent));
+}
+
+int ParserTreeModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return 0;
+    return fetched_rows.value(itemFromIndex(parent), 0);
+}
+
+int ParserTreeModel::columnCount(const QModelIndex &) const
+{
+    return COLUMN_COUNT;
+}
+
+bool ParserTreeModel::hasChildren(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return false;
+    /* По нумерации в прямом порядке обхода: не требует построения отложенного узла */
+    const ParserTreeItem* p_item = itemFromIndex(parent);
+    return p_item->getSubtreeEnd() > p_item->getPreOrder() + 1;
+}
+
+bool ParserTreeModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (!hasChildren(parent))
+        return false;
+    const ParserTreeItem* p_item = itemFromIndex(parent);
+    return fetched_rows.value(p_item, 0) < static_cast<int>(p_item->getChilds().size());
+}
+
+void ParserTreeModel::fetchMore(const QModelIndex &parent)
+{
+    const ParserTreeItem* p_item = itemFromIndex(parent);
+    int first_row = fetched_rows.value(p_item, 0);
+    int count_rows = qMin(Fetch_batch_size, static_cast<int>(p_item->getChilds().size()) - first_row);
+    if (count_rows <= 0)
+        return;
+
+    beginInsertRows(parent, first_row, first_row + count_rows - 1);
+    fetched_rows[p_item] = first_row + count_rows;
+    endInsertRows();
+}
+
+QVariant ParserTreeModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || role != Qt::DisplayRole)
+        return QVariant();
+    const ParserTreeItem* p_item = itemFromIndex(index);
+
+    if (index.column() == TAG_COLUMN)
+        return QString::fromStdString(tree->getItemKeyText(*p_item));
+
+    /* Собственные тексты узла (без текстов потомков) */
+    std::string text;
+    for (unsigned int text_num = 0; text_num < p_item->getTexts().size() && text.size() < static_cast<std::size_t>(Max_display_text_length); text_num++)
+        text += p_item->getDecodedText(text_num);
+    QString display_text = QString::fromStdString(text).simplified();
+    if (display_text.size() > Max_display_text_length)
+        display_text = display_text.left(Max_display_text_length) + "...";
+    return display_text;
+}
+
+QVariant ParserTreeModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+    switch (section)
+    {
+    case TAG_COLUMN:
+        return tr("Tag");
+    case TEXT_COLUMN:
+        return tr("Text");
+    default:
+        return QVariant();
+    }
+}
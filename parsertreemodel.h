@@ -0,0 +1,52 @@
+#ifndef PARSERTREEMODEL_H
+#define PARSERTREEMODEL_H
+
+#include <QAbstractItemModel>
+#include <QHash>
+#include <memory>
+
+class ParserTree;
+class ParserTreeItem;
+
+/// Модель дерева ParserTree для QTreeView
+/** @details Строки модели - дочерние узлы (ParserTreeItem::getChilds()), номер строки - ParserTreeItem::getColumn().
+ *  Дочерние узлы добавляются в модель порциями по мере раскрытия и прокрутки (fetchMore()),
+ *  текст строки формируется только для отображаемых строк. Для отложенного дерева (ParseOptions::lazy_tree)
+ *  узлы строятся только при раскрытии родителя
+ */
+class ParserTreeModel : public QAbstractItemModel
+{
+    Q_OBJECT
+
+public:
+    /// Колонки модели
+    enum Column { TAG_COLUMN, TEXT_COLUMN, COLUMN_COUNT };
+
+    /** Конструктор
+     * @param [in] parser_tree - дерево, для которого выполнен createTree()
+     * @param [in] parent - родительский объект
+     */
+    explicit ParserTreeModel(std::shared_ptr<const ParserTree> parser_tree, QObject *parent = 0);
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &index) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    /** Узел строки
+     * @param [in] index - индекс модели
+     * @return узел дерева (коренной узел для недействительного индекса)
+     */
+    const ParserTreeItem* itemFromIndex(const QModelIndex &index) const;
+
+private:
+    std::shared_ptr<const ParserTree> tree;         ///< Отображаемое дерево
+    QHash<const ParserTreeItem*, int> fetched_rows; ///< Количество добавленных в модель дочерних узлов
+};
+
+#endif // PARSERTREEMODEL_H
@@ -3,23 +3,42 @@
 
 // Возможные функции поиска (прототипы):
 // Начало ключевой зоны:
-unsigned int standartFindBeginKeyAreaPosition(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int rootItemFindBeginKeyAreaPosition(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int emptyElementFindBeginKeyAreaPosition(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t standartFindBeginKeyAreaPosition(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t rootItemFindBeginKeyAreaPosition(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t emptyElementFindBeginKeyAreaPosition(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree);
 
 // Начало данных ключа:
-unsigned int standartFindBeginDataPosition(const std::string& s, unsigned int begin_key_area_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int rootItemFindBeginDataPosition(const std::string& s, unsigned int begin_key_area_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t standartFindBeginDataPosition(const std::string& s, std::size_t begin_key_area_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t rootItemFindBeginDataPosition(const std::string& s, std::size_t begin_key_area_pos, const std::string& key_name, const ParserTree& tree);
 
 // Конец данных ключа:
-unsigned int standartFindEndDataPosition(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int rootItemFindEndDataPosition(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int emptyElementFindEndDataPosition(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t standartFindEndDataPosition(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t rootItemFindEndDataPosition(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t emptyElementFindEndDataPosition(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree);
 
 // Конец ключевой зоны:
-unsigned int standartFindEndKeyAreaPosition(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int rootItemFindEndKeyAreaPosition(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree);
-unsigned int emptyElementFindEndKeyAreaPosition(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t standartFindEndKeyAreaPosition(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t rootItemFindEndKeyAreaPosition(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree);
+std::size_t emptyElementFindEndKeyAreaPosition(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree);
+
+/** Поиск начала ключа: слова ключа ("<div"), за которым следует '>' или ' '
+ * @details Без учёта регистра (KeySet::isCaseInsensitive()) выполняется за один проход по строке
+ * @param [in] s - строка, в которой выполняется поиск
+ * @param [in] begin_pos - позиция, с которой начинается поиск
+ * @param [in] key_word - слово ключа
+ * @param [in] tree - дерево, которое вызывает функцию
+ * @return позиция начала ключа в строке
+ */
+static std::size_t findKeyWord(const std::string& s, std::size_t begin_pos, const std::string& key_word, const ParserTree& tree);
+
+/** Поиск строки ключа ("</div>")
+ * @param [in] s - строка, в которой выполняется поиск
+ * @param [in] begin_pos - позиция, с которой начинается поиск
+ * @param [in] key_str - строка ключа
+ * @param [in] tree - дерево, которое вызывает функцию
+ * @return позиция строки ключа
+ */
+static std::size_t findKeyString(const std::string& s, std::size_t begin_pos, const std::string& key_str, const ParserTree& tree);
 
 //=================================================================
 
@@ -64,17 +83,14 @@ const KeyType::SearchPositionFunctions findSearchFunction(const std::string& key
 
 // Возможные функции поиска (объявления):
 // Начало ключевой зоны:
-unsigned int standartFindBeginKeyAreaPosition(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t standartFindBeginKeyAreaPosition(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree)
 {
-    Q_UNUSED(tree);
-    unsigned int whitespace_pos = key_name.find(' ');
+    std::size_t whitespace_pos = key_name.find(' ');
     const std::string& key_word = key_name.substr(0, whitespace_pos - 1);
-    unsigned int find1 = s.find(key_word + '>', begin_pos);
-    unsigned int find2 = s.find(key_word + ' ', begin_pos);
-    return find1 < find2 ? find1 : find2;
+    return findKeyWord(s, begin_pos, key_word, tree);
 }
 
-unsigned int rootItemFindBeginKeyAreaPosition(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t rootItemFindBeginKeyAreaPosition(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(s);
     Q_UNUSED(begin_pos);
@@ -83,26 +99,24 @@ unsigned int rootItemFindBeginKeyAreaPosition(const std::string& s, unsigned int
     return 0;
 }
 
-unsigned int emptyElementFindBeginKeyAreaPosition(const std::string& s, unsigned int begin_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t emptyElementFindBeginKeyAreaPosition(const std::string& s, std::size_t begin_pos, const std::string& key_name, const ParserTree& tree)
 {
-    Q_UNUSED(tree);
-    unsigned int end_key_word_pos = key_name.find('>');
+    std::size_t end_key_word_pos = key_name.find('>');
     const std::string& key_word = key_name.substr(0, end_key_word_pos);
-    unsigned int find1 = s.find(key_word + '>', begin_pos);
-    unsigned int find2 = s.find(key_word + ' ', begin_pos);
-    return find1 < find2 ? find1 : find2;
+    return findKeyWord(s, begin_pos, key_word, tree);
 }
 
 
 // Начало данных ключа:
-unsigned int standartFindBeginDataPosition(const std::string& s, unsigned int begin_key_area_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t standartFindBeginDataPosition(const std::string& s, std::size_t begin_key_area_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(key_name);
     Q_UNUSED(tree);
-    return s.find('>', begin_key_area_pos) + 1;
+    std::size_t end_tag_pos = s.find('>', begin_key_area_pos);
+    return end_tag_pos == std::string::npos ? std::string::npos : end_tag_pos + 1;
 }
 
-unsigned int rootItemFindBeginDataPosition(const std::string& s, unsigned int begin_key_area_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t rootItemFindBeginDataPosition(const std::string& s, std::size_t begin_key_area_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(s);
     Q_UNUSED(begin_key_area_pos);
@@ -113,17 +127,16 @@ unsigned int rootItemFindBeginDataPosition(const std::string& s, unsigned int be
 
 
 // Конец данных ключа:
-unsigned int standartFindEndDataPosition(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t standartFindEndDataPosition(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree)
 {
-    Q_UNUSED(tree);
     int count_nested_same_name_keys = 0;
-    unsigned int whitespace_pos = key_name.find(' ');
+    std::size_t whitespace_pos = key_name.find(' ');
     const std::string end_key_str = key_name.substr(whitespace_pos + 1);
-    unsigned int find_begin, find_end;
-    unsigned int end_key_word;
+    std::size_t find_begin, find_end;
+    std::size_t end_key_word;
 
     find_begin = standartFindBeginKeyAreaPosition(s, begin_data_pos, key_name, tree);
-    find_end = s.find(end_key_str, begin_data_pos);
+    find_end = findKeyString(s, begin_data_pos, end_key_str, tree);
 
     /* Treat nested keys */
     while (find_begin < find_end)
@@ -133,13 +146,13 @@ unsigned int standartFindEndDataPosition(const std::string& s, unsigned int begi
         end_key_word = standartFindBeginDataPosition(s, find_begin, key_name, tree);
         find_begin = standartFindBeginKeyAreaPosition(s, end_key_word, key_name, tree);
         end_key_word = standartFindEndKeyAreaPosition(s, find_end, key_name, tree);
-        find_end = s.find(end_key_str, end_key_word);
+        find_end = findKeyString(s, end_key_word, end_key_str, tree);
     }
 
     return find_end;
 }
 
-unsigned int rootItemFindEndDataPosition(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t rootItemFindEndDataPosition(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(begin_data_pos);
     Q_UNUSED(key_name);
@@ -147,7 +160,7 @@ unsigned int rootItemFindEndDataPosition(const std::string& s, unsigned int begi
     return s.size();
 }
 
-unsigned int emptyElementFindEndDataPosition(const std::string& s, unsigned int begin_data_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t emptyElementFindEndDataPosition(const std::string& s, std::size_t begin_data_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(s);
     Q_UNUSED(key_name);
@@ -157,14 +170,15 @@ unsigned int emptyElementFindEndDataPosition(const std::string& s, unsigned int
 
 
 // Конец ключевой зоны:
-unsigned int standartFindEndKeyAreaPosition(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t standartFindEndKeyAreaPosition(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(key_name);
     Q_UNUSED(tree);
-    return s.find('>', end_data_pos) + 1;
+    std::size_t end_tag_pos = s.find('>', end_data_pos);
+    return end_tag_pos == std::string::npos ? std::string::npos : end_tag_pos + 1;
 }
 
-unsigned int rootItemFindEndKeyAreaPosition(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t rootItemFindEndKeyAreaPosition(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(end_data_pos);
     Q_UNUSED(key_name);
@@ -172,10 +186,42 @@ unsigned int rootItemFindEndKeyAreaPosition(const std::string& s, unsigned int e
     return s.size();
 }
 
-unsigned int emptyElementFindEndKeyAreaPosition(const std::string& s, unsigned int end_data_pos, const std::string& key_name, const ParserTree& tree)
+std::size_t emptyElementFindEndKeyAreaPosition(const std::string& s, std::size_t end_data_pos, const std::string& key_name, const ParserTree& tree)
 {
     Q_UNUSED(s);
     Q_UNUSED(key_name);
     Q_UNUSED(tree);
     return end_data_pos;
 }
+
+
+//=================================================================
+
+/* === Other funtion === */
+std::size_t findKeyWord(const std::string& s, std::size_t begin_pos, const std::string& key_word, const ParserTree& tree)
+{
+    if (!tree.getKeySet().isCaseInsensitive())
+    {
+        std::size_t find1 = s.find(key_word + '>', begin_pos);
+        std::size_t find2 = s.find(key_word + ' ', begin_pos);
+        return find1 < find2 ? find1 : find2;
+    }
+
+    /* Один проход: ищем слово ключа и проверяем следующий символ */
+    std::string::size_type find_pos = findIgnoreAsciiCase(s, key_word, begin_pos);
+    while (find_pos != std::string::npos)
+    {
+        std::string::size_type next_pos = find_pos + key_word.size();
+        if (next_pos < s.size() && (s[next_pos] == '>' || s[next_pos] == ' '))
+            return find_pos;
+        find_pos = findIgnoreAsciiCase(s, key_word, find_pos + 1);
+    }
+    return find_pos;
+}
+
+std::size_t findKeyString(const std::string& s, std::size_t begin_pos, const std::string& key_str, const ParserTree& tree)
+{
+    if (tree.getKeySet().isCaseInsensitive())
+        return findIgnoreAsciiCase(s, key_str, begin_pos);
+    return s.find(key_str, begin_pos);
+}
@@ -0,0 +1,498 @@
+#include "parser.h"
+#include <cstring>
+#include <cctype>
+
+/** Поиск конца тега
+ * @details Символы '>' внутри значений атрибутов в кавычках пропускаются
+ * @param [in] s - текст
+ * @param [in] pos - позиция после имени тега
+ * @return позиция '>' или std::string::npos
+ */
+static std::string::size_type findTagEnd(const std::string& s, std::string::size_type pos);
+
+/** Проверка символа имени тега
+ * @param [in] c - символ
+ * @return может ли символ входить в имя тега
+ */
+static bool isTagNameChar(char c);
+
+//=================================================================
+
+/* === TagScanner === */
+// Конструктор:
+TagScanner::TagScanner(const std::string& s, const KeySet& key_set, std::size_t begin_pos)
+    : text(s), keys(key_set), pos(begin_pos),
+      script_tag_id(key_set.findTagId("script")), style_tag_id(key_set.findTagId("style"))
+{
+}
+
+// Следующий тег:
+bool TagScanner::next(Tag& tag)
+{
+    while (pos < text.size())
+    {
+        const char* p_found = static_cast<const char*>(std::memchr(text.data() + pos, '<', text.size() - pos));
+        if (p_found == nullptr)
+            break;
+        std::string::size_type begin_tag = p_found - text.data();
+        std::string::size_type name_pos = begin_tag + 1;
+
+        /* Комментарии и объявления ("<!DOCTYPE ...>", "<?xml ...?>") */
+        if (text.compare(begin_tag, 4, "<!--") == 0)
+        {
+            std::string::size_type end_comment = text.find("-->", begin_tag + 4);
+            pos = end_comment == std::string::npos ? text.size() : end_comment + 3;
+            continue;
+        }
+        if (name_pos < text.size() && (text[name_pos] == '!' || text[name_pos] == '?'))
+        {
+            std::string::size_type end_declaration = text.find('>', name_pos);
+            pos = end_declaration == std::string::npos ? text.size() : end_declaration + 1;
+            continue;
+        }
+
+        bool is_close_tag = name_pos < text.size() && text[name_pos] == '/';
+        if (is_close_tag)
+            name_pos++;
+        std::string::size_type end_name = name_pos;
+        while (end_name < text.size() && isTagNameChar(text[end_name]))
+            end_name++;
+        if (end_name == name_pos)       // Не тег ("a < b")
+        {
+            pos = begin_tag + 1;
+            continue;
+        }
+
+        std::string::size_type end_tag = findTagEnd(text, end_name);
+        if (end_tag == std::string::npos)
+            break;
+        pos = end_tag + 1;
+
+        TagId tag_id = keys.findTagId(text.substr(name_pos, end_name - name_pos));
+        if (tag_id == KeySet::NO_TAG_ID)
+            continue;
+
+        tag.tag_id = tag_id;
+        tag.begin_pos = begin_tag;
+        tag.end_pos = end_tag + 1;
+        if (is_close_tag)
+            tag.kind = CLOSE_TAG;
+        else if (keys.isEmptyElement(tag_id) || text[end_tag - 1] == '/')
+            tag.kind = EMPTY_TAG;
+        else
+            tag.kind = OPEN_TAG;
+
+        /* Данные script и style не содержат тегов: переходим сразу к закрывающему тегу */
+        if (tag.kind == OPEN_TAG && (tag_id == script_tag_id || tag_id == style_tag_id))
+        {
+            std::string close_tag = "</" + keys.getTagName(tag_id);
+            std::string::size_type close_pos = keys.isCaseInsensitive() ? findIgnoreAsciiCase(text, close_tag, pos)
+                                                                        : text.find(close_tag, pos);
+            pos = close_pos == std::string::npos ? text.size() : close_pos;
+        }
+        return true;
+    }
+
+    pos = text.size();
+    return false;
+}
+
+//=================================================================
+
+
+/* === ElementExtractor === */
+// Конструктор:
+ElementExtractor::ElementExtractor(const KeySet& key_set, const std::vector<std::string>& target_paths, unsigned int count_limit)
+    : keys(key_set), limit(count_limit)
+{
+    for (const std::string& path : target_paths)
+    {
+        Target target;
+        target.from_root = !path.empty() && path[0] == '/';
+
+        /* Разбираем шаги "tag[attribute=value]" */
+        bool valid = !path.empty();
+        std::string::size_type begin_step = target.from_root ? 1 : 0;
+        while (valid && begin_step <= path.size())
+        {
+            std::string::size_type end_step = path.find('/', begin_step);
+            if (end_step == std::string::npos)
+                end_step = path.size();
+            std::string step_text = path.substr(begin_step, end_step - begin_step);
+            begin_step = end_step + 1;
+
+            PathStep step;
+            step.check_value = false;
+            std::string::size_type bracket_pos = step_text.find('[');
+            if (bracket_pos != std::string::npos)
+            {
+                if (step_text.back() != ']')
+                {
+                    valid = false;
+                    break;
+                }
+                std::string condition = step_text.substr(bracket_pos + 1, step_text.size() - bracket_pos - 2);
+                std::string::size_type equal_pos = condition.find('=');
+                step.attribute_name = condition.substr(0, equal_pos);
+                if (equal_pos != std::string::npos)
+                {
+                    step.attribute_value = condition.substr(equal_pos + 1);
+                    /* Значение может быть в кавычках */
+                    if (step.attribute_value.size() >= 2 && (step.attribute_value[0] == '"' || step.attribute_value[0] == '\'')
+                            && step.attribute_value.back() == step.attribute_value[0])
+                        step.attribute_value = step.attribute_value.substr(1, step.attribute_value.size() - 2);
+                    step.check_value = true;
+                }
+                step_text.erase(bracket_pos);
+            }
+            step.tag_id = keys.findTagId(step_text);
+            if (step.tag_id == KeySet::NO_TAG_ID)
+                valid = false;
+            target.steps.push_back(step);
+        }
+
+        if (!valid)
+        {
+            error_description += "Can't parse target " + path + "\n";
+            target.steps.clear();
+        }
+        targets.push_back(target);
+    }
+}
+
+
+// Извлечение элементов:
+std::size_t ElementExtractor::extract(const std::string& text, std::vector<std::vector<KeyPositionType>>& results) const
+{
+    /* Открытый элемент: положение тега и номер цели, ожидающей конца элемента */
+    struct OpenElement
+    {
+        TagScanner::Tag tag;
+        std::vector<std::pair<unsigned int, unsigned int>> pending_results;  // (номер цели, номер результата)
+    };
+    std::vector<OpenElement> open_elements;
+
+    results.assign(targets.size(), std::vector<KeyPositionType>());
+    unsigned int count_pending = 0;         // Найдено, но не закрыто
+    unsigned int count_incomplete = 0;      // Целей, для которых найдено меньше limit
+    for (const Target& target : targets)
+        if (!target.steps.empty())
+            count_incomplete++;
+    if (count_incomplete == 0)
+        return 0;
+
+    auto finish_element = [&results, &count_pending](const OpenElement& element, std::size_t end_data_pos, std::size_t end_key_area_pos)
+    {
+        for (const std::pair<unsigned int, unsigned int>& pending : element.pending_results)
+        {
+            KeyPositionType& key_position = results[pending.first][pending.second];
+            key_position.setEndDataPosition(end_data_pos);
+            key_position.setEndKeyAreaPosition(end_key_area_pos);
+            count_pending--;
+        }
+    };
+
+    TagScanner scanner(text, keys);
+    TagScanner::Tag tag;
+    while (scanner.next(tag))
+    {
+        if (tag.kind == TagScanner::CLOSE_TAG)
+        {
+            /* Закрываем элемент и все незакрытые вложенные в него (например, <p> без </p>) */
+            std::vector<OpenElement>::size_type open_num = open_elements.size();
+            while (open_num > 0 && open_elements[open_num - 1].tag.tag_id != tag.tag_id)
+                open_num--;
+            if (open_num == 0)
+                continue;       // Закрывающий тег без открывающего
+            while (open_elements.size() >= open_num)
+            {
+                finish_element(open_elements.back(), tag.begin_pos, open_elements.size() == open_num ? tag.end_pos : tag.begin_pos);
+                open_elements.pop_back();
+            }
+        }
+        else
+        {
+            OpenElement element;
+            element.tag = tag;
+
+            /* Сравниваем цели с тегом и его предками */
+            for (unsigned int target_num = 0; target_num < targets.size(); target_num++)
+            {
+                const Target& target = targets[target_num];
+                if (target.steps.empty() || (limit != 0 && results[target_num].size() >= limit))
+                    continue;
+                if (target.from_root && target.steps.size() != open_elements.size() + 1)
+                    continue;
+                if (target.steps.size() > open_elements.size() + 1)
+                    continue;
+
+                bool matched = matchStep(target.steps.back(), tag.tag_id, text, tag.begin_pos, tag.end_pos);
+                for (std::vector<PathStep>::size_type step_num = 1; matched && step_num < target.steps.size(); step_num++)
+                {
+                    const PathStep& step = target.steps[target.steps.size() - 1 - step_num];
+                    const TagScanner::Tag& ancestor = open_elements[open_elements.size() - step_num].tag;
+                    matched = matchStep(step, ancestor.tag_id, text, ancestor.begin_pos, ancestor.end_pos);
+                }
+                if (!matched)
+                    continue;
+
+                results[target_num].push_back(KeyPositionType(tag.tag_id, tag.begin_pos, tag.end_pos, tag.end_pos, tag.end_pos));
+                if (tag.kind == TagScanner::OPEN_TAG)
+                {
+                    element.pending_results.push_back(std::make_pair(target_num, results[target_num].size() - 1));
+                    count_pending++;
+                }
+                if (limit != 0 && results[target_num].size() == limit)
+                    count_incomplete--;
+            }
+
+            if (tag.kind == TagScanner::OPEN_TAG)
+                open_elements.push_back(element);
+        }
+
+        /* Все цели найдены и закрыты - дальше текст не просматриваем */
+        if (count_incomplete == 0 && count_pending == 0)
+            return scanner.getPosition();
+    }
+
+    /* Незакрытые до конца текста элементы */
+    while (!open_elements.empty())
+    {
+        finish_element(open_elements.back(), text.size(), text.size());
+        open_elements.pop_back();
+    }
+    return scanner.getPosition();
+}
+
+
+// Проверка шага пути:
+bool ElementExtractor::matchStep(const PathStep& step, TagId tag_id, const std::string& text,
+                                 std::size_t begin_tag_pos, std::size_t end_tag_pos) const
+{
+    if (step.tag_id != tag_id)
+        return false;
+    if (step.attribute_name.empty())
+        return true;
+
+    std::string value;
+    if (!findAttributeValue(text, begin_tag_pos, end_tag_pos, step.attribute_name, value))
+        return false;
+    return !step.check_value || value == step.attribute_value;
+}
+
+
+//=================================================================
+
+
+/* === TableExtractor === */
+// Конструктор:
+TableExtractor::TableExtractor()
+{
+    keys.setCaseInsensitive(true);
+    table_tag_id = keys.add(KeyType("<table> </table>"));
+    row_tag_id = keys.add(KeyType("<tr> </tr>"));
+    data_cell_tag_id = keys.add(KeyType("<td> </td>"));
+    header_cell_tag_id = keys.add(KeyType("<th> </th>"));
+    keys.add(KeyType("<script> </script>"));
+    keys.add(KeyType("<style> </style>"));
+}
+
+
+// Извлечение строк таблиц:
+std::size_t TableExtractor::extract(const std::string& text, TableRowHandler& handler) const
+{
+    /* Открытая таблица: текущая строка и открытая ячейка */
+    struct OpenTable
+    {
+        TableRow row;
+        bool row_open;
+        bool cell_open;
+        std::size_t begin_cell_pos;     // Позиция после открывающего тега ячейки
+    };
+    std::vector<OpenTable> open_tables;
+    unsigned int count_tables = 0;
+    std::size_t count_rows = 0;
+
+    auto close_cell = [&text](OpenTable& table, std::size_t end_cell_pos)
+    {
+        if (!table.cell_open)
+            return;
+        table.cell_open = false;
+
+        /* Пробелы по краям ячейки не входят в отрезок */
+        std::size_t begin_pos = table.begin_cell_pos;
+        while (begin_pos < end_cell_pos && std::isspace(static_cast<unsigned char>(text[begin_pos])))
+            begin_pos++;
+        while (end_cell_pos > begin_pos && std::isspace(static_cast<unsigned char>(text[end_cell_pos - 1])))
+            end_cell_pos--;
+        TextView cell = { text.data() + begin_pos, end_cell_pos - begin_pos };
+        table.row.cells.push_back(cell);
+    };
+    auto close_row = [&close_cell, &handler, &count_rows](OpenTable& table, std::size_t end_row_pos)
+    {
+        close_cell(table, end_row_pos);
+        if (!table.row_open)
+            return;
+        table.row_open = false;
+        if (!table.row.cells.empty())
+        {
+            handler.addRow(table.row);
+            table.row.row_num++;
+            count_rows++;
+        }
+        table.row.cells.clear();
+    };
+
+    TagScanner scanner(text, keys);
+    TagScanner::Tag tag;
+    while (scanner.next(tag))
+    {
+        if (tag.tag_id == table_tag_id)
+        {
+            if (tag.kind == TagScanner::OPEN_TAG)
+            {
+                OpenTable table;
+                table.row.table_num = count_tables++;
+                table.row.depth = static_cast<unsigned int>(open_tables.size());
+                table.row.row_num = 0;
+                table.row_open = false;
+                table.cell_open = false;
+                table.begin_cell_pos = 0;
+                open_tables.push_back(std::move(table));
+            }
+            else if (tag.kind == TagScanner::CLOSE_TAG && !open_tables.empty())
+            {
+                close_row(open_tables.back(), tag.begin_pos);
+                open_tables.pop_back();
+            }
+            continue;
+        }
+        if (open_tables.empty())
+            continue;       // Строки и ячейки вне таблиц
+        OpenTable& table = open_tables.back();
+
+        if (tag.tag_id == row_tag_id)
+        {
+            close_row(table, tag.begin_pos);
+            table.row_open = tag.kind == TagScanner::OPEN_TAG;
+        }
+        else if (tag.tag_id == data_cell_tag_id || tag.tag_id == header_cell_tag_id)
+        {
+            close_cell(table, tag.begin_pos);
+            if (tag.kind == TagScanner::CLOSE_TAG)
+                continue;
+            table.row_open = true;
+            table.cell_open = true;
+            table.begin_cell_pos = tag.end_pos;
+            if (tag.kind == TagScanner::EMPTY_TAG)
+                close_cell(table, tag.end_pos);
+        }
+    }
+
+    /* Незакрытые до конца текста таблицы */
+    while (!open_tables.empty())
+    {
+        close_row(open_tables.back(), text.size());
+        open_tables.pop_back();
+    }
+    return count_rows;
+}
+
+//=================================================================
+
+
+/* === CsvTableWriter === */
+// Запись строки:
+void CsvTableWriter::addRow(const TableRow& row)
+{
+    if (write_table_num)
+        output << row.table_num << separator;
+    for (std::vector<TextView>::size_type cell_num = 0; cell_num < row.cells.size(); cell_num++)
+    {
+        if (cell_num > 0)
+            output << separator;
+        const TextView& cell = row.cells[cell_num];
+        if (plain_text)
+            cell_text = htmlToPlainText(cell.data, cell.size);
+        else
+            cell_text.assign(cell.data, cell.size);
+
+        /* Поле в кавычках, если содержит разделитель, кавычки или переводы строк */
+        bool need_quotes = false;
+        for (char c : cell_text)
+            if (c == separator || c == '"' || c == '\n' || c == '\r')
+            {
+                need_quotes = true;
+                break;
+            }
+        if (!need_quotes)
+        {
+            output << cell_text;
+            continue;
+        }
+        output << '"';
+        for (char c : cell_text)
+        {
+            if (c == '"')
+                output << '"';
+            output << c;
+        }
+        output << '"';
+    }
+    output << "\r\n";
+}
+
+//=================================================================
+
+
+/* === ColumnarTable === */
+// Добавление строки:
+void ColumnarTable::addRow(const TableRow& row)
+{
+    if (has_table_filter && row.table_num != filter_table_num)
+        return;
+
+    /* Новые столбцы дополняются пустыми отрезками для предыдущих строк */
+    TextView empty_cell = { "", 0 };
+    if (row.cells.size() > columns.size())
+        columns.resize(row.cells.size(), std::vector<TextView>(row_tables.size(), empty_cell));
+    for (std::vector<std::vector<TextView>>::size_type column_num = 0; column_num < columns.size(); column_num++)
+        columns[column_num].push_back(column_num < row.cells.size() ? row.cells[column_num] : empty_cell);
+    row_tables.push_back(row.table_num);
+}
+
+
+// Очистка:
+void ColumnarTable::clear()
+{
+    columns.clear();
+    row_tables.clear();
+}
+
+
+//=================================================================
+
+/* === Other funtion === */
+std::string::size_type findTagEnd(const std::string& s, std::string::size_type pos)
+{
+    char quote = 0;
+    for (; pos < s.size(); pos++)
+    {
+        char c = s[pos];
+        if (quote != 0)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+            quote = c;
+        else if (c == '>')
+            return pos;
+    }
+    return std::string::npos;
+}
+
+bool isTagNameChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == ':';
+}
@@ -0,0 +1,767 @@
+#include "parser.h"
+#include "parser_cache.h"
+#include <iostream>
+#include <thread>
+
+/* Регрессионные проверки разбора. Ключи задаются в проверках, файл Key_list_filename не нужен.
+ *   Код возврата - количество неудачных проверок */
+
+static unsigned int count_failed = 0;       ///< Количество неудачных проверок
+
+/** Проверка условия
+ * @param [in] condition - условие
+ * @param [in] text - текст условия
+ * @param [in] line - строка проверки
+ */
+static void check(bool condition, const char* text, int line)
+{
+    if (condition)
+        return;
+    std::cerr << "parser_tests.cpp:" << line << ": check failed: " << text << std::endl;
+    count_failed++;
+}
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+/** Множество ключей проверок
+ * @return множество ключей
+ */
+static KeySet testKeySet()
+{
+    KeySet key_set;
+    const char* key_names[] = { "<div> </div>", "<p> </p>", "<b> </b>", "<i> </i>", "<u> </u>", "<a> </a>",
+                                "<span> </span>", "<table> </table>", "<tr> </tr>", "<td> </td>" };
+    for (const char* key_name : key_names)
+        key_set.add(KeyType(key_name));
+    return key_set;
+}
+
+/** Построение дерева
+ * @param [in] text - текст
+ * @param [in] options - параметры разбора
+ * @return дерево (createTree() выполнен)
+ */
+static ParserTree makeTree(const std::string& text, const ParserTree::ParseOptions& options = ParserTree::ParseOptions())
+{
+    ParserTree tree(text, testKeySet(), options);
+    tree.createTree();
+    return tree;
+}
+
+//=================================================================
+
+/* === Проверки === */
+// Декодирование HTML-сущностей: именованные, десятичные и шестнадцатеричные, неизвестные и недопустимые
+static void testHtmlEntities()
+{
+    CHECK(decodeHtmlEntities("a &amp; b &lt;&gt; &quot;") == "a & b <> \"");
+    CHECK(decodeHtmlEntities("&#1025;&#x451;&nbsp;") == "\xD0\x81\xD1\x91\xC2\xA0");
+    CHECK(decodeHtmlEntities("no entities") == "no entities");
+
+    /* Неизвестные и незавершённые сущности остаются без изменений, недопустимые коды заменяются на U+FFFD */
+    CHECK(decodeHtmlEntities("&unknown; &amp &#; &#xZZ; &") == "&unknown; &amp &#; &#xZZ; &");
+    CHECK(decodeHtmlEntities("&#0;&#x110000;&#55296;") == "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD");
+}
+
+// Пробельные отрывки: сохранение, свёртка и удаление; интернирование коротких отрывков
+static void testWhitespaceModes()
+{
+    const std::string text = "<div>\n  <p>a</p> <p>a</p>\t<p>long text</p>\n</div>";
+    ParserTree::ParseOptions options;
+    ParserTree keep_tree(text, testKeySet(), options);
+    CHECK(keep_tree.createTree());
+    const ParserTreeItem& keep_div_item = *keep_tree.getRootItem().getChilds()[0];
+    CHECK(keep_div_item.getTexts().size() == 4);
+    CHECK(*keep_div_item.getTexts()[0] == "\n  " && *keep_div_item.getTexts()[2] == "\t");
+
+    /* Свёрнутые отрывки хранятся в одном экземпляре */
+    options.whitespace_mode = ParserTree::COLLAPSE_WHITESPACE;
+    ParserTree collapse_tree(text, testKeySet(), options);
+    CHECK(collapse_tree.createTree());
+    const ParserTreeItem& collapse_div_item = *collapse_tree.getRootItem().getChilds()[0];
+    CHECK(collapse_div_item.getTexts().size() == 4);
+    CHECK(*collapse_div_item.getTexts()[0] == "\n" && *collapse_div_item.getTexts()[1] == " ");
+    CHECK(*collapse_div_item.getTexts()[2] == " " && *collapse_div_item.getTexts()[3] == "\n");
+    CHECK(collapse_div_item.getTexts()[0] == collapse_div_item.getTexts()[3]);
+    CHECK(collapse_div_item.getTexts()[1] == collapse_div_item.getTexts()[2]);
+
+    options.whitespace_mode = ParserTree::DROP_WHITESPACE;
+    ParserTree drop_tree(text, testKeySet(), options);
+    CHECK(drop_tree.createTree());
+    const ParserTreeItem& drop_div_item = *drop_tree.getRootItem().getChilds()[0];
+    CHECK(drop_div_item.getTexts().empty() && drop_div_item.getChilds().size() == 3);
+    CHECK(drop_div_item.getLocationSequenceOfData().size() == 3);
+
+    /* Короткие отрывки интернируются, длинные хранятся отдельно */
+    options.intern_texts = true;
+    options.max_interned_text_length = 4;
+    ParserTree intern_tree(text, testKeySet(), options);
+    CHECK(intern_tree.createTree());
+    const ParserTreeItem& intern_div_item = *intern_tree.getRootItem().getChilds()[0];
+    CHECK(intern_div_item.getChilds()[0]->getTexts()[0] == intern_div_item.getChilds()[1]->getTexts()[0]);
+    CHECK(*intern_div_item.getChilds()[2]->getTexts()[0] == "long text");
+    CHECK(intern_tree.getTextPool().getInternedTextsCount() == 1 && intern_tree.getTextPool().getTextsCount() == 1);
+    CHECK(intern_tree.getTextPool().getCountInternRequests() == 2);
+}
+
+// Идентификаторы ключей: имя тега, идентификатор и ключ переводятся друг в друга
+static void testTagIds()
+{
+    KeySet key_set;
+    CHECK(key_set.size() == 1 && key_set.getTagName(KeySet::ROOT_TAG_ID).empty());
+    const TagId div_id = key_set.add(KeyType("<div> </div>"));
+    const TagId br_id = key_set.add(KeyType("<br>"));
+    CHECK(key_set.add(KeyType("<div> </div>")) == div_id && key_set.size() == 3);
+    CHECK(key_set.findTagId("div") == div_id && key_set.getTagName(div_id) == "div");
+    CHECK(key_set.getKey(div_id).getName() == "<div> </div>");
+    CHECK(key_set.findTagId("br") == br_id && key_set.getKey(br_id).getName() == "<br>");
+    CHECK(key_set.findTagId("span") == KeySet::NO_TAG_ID);
+    CHECK(key_set.getTagName(KeyPositionType(div_id, 0, 19, 5, 13).getTagId()) == "div");
+
+    /* Узлы хранят идентификатор ключа в множестве ключей дерева */
+    ParserTree tree("<div><p>a</p></div>", testKeySet());
+    CHECK(tree.createTree());
+    const ParserTreeItem& p_item = *tree.getRootItem().getChilds()[0]->getChilds()[0];
+    CHECK(tree.getKeySet().getTagName(p_item.getTagId()) == "p");
+    CHECK(tree.getKeySet().findTagId("p") == p_item.getTagId());
+    CHECK(tree.getKey(p_item).getName() == "<p> </p>");
+    CHECK(tree.getRootItem().getTagId() == KeySet::ROOT_TAG_ID);
+}
+
+// Вложенность: номера в прямом порядке обхода, концы поддеревьев, поиск потомков и вложенных ключей
+static void testNesting()
+{
+    const std::string text = "<div><table><tr><td><a>1</a></td></tr></table><a>2</a></div><table><a>3</a></table>";
+    ParserTree tree(text, testKeySet());
+    CHECK(tree.createTree());
+    const ParserTreeItem& root_item = tree.getRootItem();
+    const ParserTreeItem& div_item = *root_item.getChilds()[0];
+    const ParserTreeItem& td_item = *div_item.getChilds()[0]->getChilds()[0]->getChilds()[0];
+    const ParserTreeItem& a_item = *td_item.getChilds()[0];
+    const ParserTreeItem& table_item = *root_item.getChilds()[1];
+    CHECK(root_item.getPreOrder() == 0 && root_item.getSubtreeEnd() == 9);
+    CHECK(div_item.getPreOrder() == 1 && div_item.getSubtreeEnd() == 7);
+    CHECK(a_item.getPreOrder() == 5 && a_item.getSubtreeEnd() == 6);
+    CHECK(table_item.getPreOrder() == 7 && table_item.getSubtreeEnd() == 9);
+    CHECK(a_item.getParent() == &td_item && root_item.getParent() == nullptr);
+    CHECK(tree.findItemByPreOrder(5) == &a_item);
+
+    CHECK(div_item.isAncestorOf(a_item) && root_item.isAncestorOf(a_item));
+    CHECK(!a_item.isAncestorOf(div_item) && !table_item.isAncestorOf(a_item) && !a_item.isAncestorOf(a_item));
+
+    const TagId a_id = tree.getKeySet().findTagId("a");
+    CHECK(tree.findDescendants(div_item, a_id).size() == 2);
+    CHECK(tree.findDescendants(table_item, a_id).size() == 1);
+    CHECK(tree.findDescendants(a_item, a_id).empty());
+
+    /* Ссылки внутри таблиц: первая и третья */
+    CHECK(tree.find(KeyType("<a> </a>")).getLastFind().size() == 3);
+    tree.find(KeyType("<table> </table>")).findNested(KeyType("<a> </a>"));
+    const std::vector<ParserTreeItem*>& nested_items = tree.getLastFind();
+    CHECK(nested_items.size() == 2 && nested_items[0] == &a_item);
+    CHECK(nested_items.size() == 2 && nested_items[1] == table_item.getChilds()[0]);
+}
+
+// Оценка памяти: сумма составляющих, рост при построении дерева, превышение бюджета
+static void testMemoryUsage()
+{
+    std::string text;
+    for (int div_num = 0; div_num < 20; div_num++)
+        text += "<div><p>a</p><p>b</p></div>";
+    ParserTree tree(text, testKeySet());
+    const ParserTree::MemoryUsage usage = tree.getMemoryUsage();
+    CHECK(usage.total == usage.source_text + usage.key_positions + usage.items + usage.texts);
+    CHECK(usage.source_text >= text.size() && usage.key_positions >= 60 * sizeof(KeyPositionType));
+
+    CHECK(tree.createTree());
+    const ParserTree::MemoryUsage tree_usage = tree.getMemoryUsage();
+    CHECK(tree_usage.total == tree_usage.source_text + tree_usage.key_positions + tree_usage.items + tree_usage.texts);
+    CHECK(tree_usage.items > usage.items && tree_usage.texts > usage.texts);
+
+    /* Бюджет меньше текста с местоположениями ключей: разбор прекращается с ошибкой */
+    ParserTree::ParseOptions options;
+    options.memory_budget = usage.total / 2;
+    ParserTree small_tree(text, testKeySet(), options);
+    CHECK(!small_tree.createTree());
+    CHECK(small_tree.getErrorDescription().find("budget") != std::string::npos);
+    CHECK(small_tree.getRootItem().getChilds().empty());
+}
+
+// Ключи без учёта регистра: один идентификатор для всех вариантов имени, разбор смешанной разметки
+static void testCaseInsensitiveKeys()
+{
+    KeySet key_set = testKeySet();
+    CHECK(key_set.findTagId("DIV") == KeySet::NO_TAG_ID);
+    key_set.setCaseInsensitive(true);
+    CHECK(key_set.findTagId("DIV") != KeySet::NO_TAG_ID);
+    CHECK(key_set.findTagId("DIV") == key_set.findTagId("div") && key_set.findTagId("Div") == key_set.findTagId("div"));
+
+    ParserTree tree("<DIV><p>a</P><Div>b</div></div>", key_set);
+    CHECK(tree.createTree());
+    CHECK(tree.getRootItem().getChilds().size() == 1);
+    const ParserTreeItem& div_item = *tree.getRootItem().getChilds()[0];
+    CHECK(div_item.getChilds().size() == 2 && *div_item.getChilds()[0]->getTexts()[0] == "a");
+    CHECK(div_item.getChilds().size() == 2 && div_item.getChilds()[1]->getTagId() == div_item.getTagId());
+    CHECK(tree.find(KeyType("<div> </div>")).getLastFind().size() == 2);
+}
+
+// Незавершённые теги в конце текста: ошибка с позицией начала поиска вместо зацикливания
+static void testUnterminatedTags()
+{
+    ParserTree tree("<p>a</p><p class=x", testKeySet());
+    CHECK(tree.getErrorDescription().find("Can't find begin data position by <p> </p>") != std::string::npos);
+    CHECK(tree.getErrorDescription().find("search start from 8") != std::string::npos);
+    CHECK(!tree.createTree());
+
+    ParserTree first_tag_tree("<p class=\"x\"", testKeySet());
+    CHECK(first_tag_tree.getErrorDescription().find("search start from 0") != std::string::npos);
+    ParserTree unclosed_tree("<div><p>a</p>", testKeySet());
+    CHECK(unclosed_tree.getErrorDescription().find("Can't find end data position by <div>") != std::string::npos);
+
+    /* Обрывок имени тега без '>' - обычный текст */
+    ParserTree tail_tree("<p>a</p><p", testKeySet());
+    CHECK(tail_tree.createTree() && tail_tree.getRootItem().getChilds().size() == 1);
+    CHECK(tail_tree.getRootItem().getTexts().size() == 1 && *tail_tree.getRootItem().getTexts()[0] == "<p");
+}
+
+// Перекрывающиеся теги: хэши содержимого совпадают с текстами дерева, отложенное дерево совпадает с обычным
+static void testOverlappingTags()
+{
+    const std::string texts[] = {
+        "<p>a<b>x<i>y</b>z</i>w</p>",
+        "<p>a<b>x<i>y</b>z<u>q</u></i>w</p>",
+        "<div><b><i></b></i><u>t</u></div>",
+        "<div><i>a<b>b</i>c</b>d</div>"
+    };
+    for (const std::string& text : texts)
+    {
+        ParserTree tree = makeTree(text);
+        CHECK(tree.getErrorDescription().empty());
+
+        ParserTree::ParseOptions lazy_options;
+        lazy_options.lazy_tree = true;
+        ParserTree lazy_tree = makeTree(text, lazy_options);
+        CHECK(lazy_tree.outASCIITree() == tree.outASCIITree());
+        CHECK(lazy_tree.getContentHash(lazy_tree.getRootItem()) == tree.getContentHash(tree.getRootItem()));
+
+        /* Одинаковые тексты дают одинаковые хэши и не дают различий */
+        ParserTree same_tree = makeTree(text);
+        CHECK(same_tree.getContentHash(same_tree.getRootItem()) == tree.getContentHash(tree.getRootItem()));
+        CHECK(tree.diff(same_tree).empty());
+    }
+}
+
+// Поток ключей: вложенные и перекрывающиеся теги, позиции не убывают, границы range()
+static void testTokenStream()
+{
+    const std::string texts[] = {
+        "<div><p>a<b>b</b></p><u></u></div>",
+        "<p>a<b>x<i>y</b>z<u>q</u></i>w</p>",
+        "<div><i>a<b>b</i>c</b>d</div>"
+    };
+    for (const std::string& text : texts)
+    {
+        ParserTree tree(text, testKeySet());
+        CHECK(tree.getErrorDescription().empty());
+        TokenStream stream(tree.getKeyPositions());
+        CHECK(stream.size() == tree.getKeyPositions().size() * 2);
+        for (std::size_t token_num = 0; token_num < stream.size(); token_num++)
+        {
+            if (token_num > 0)
+                CHECK(stream.getTokenPosition(token_num - 1) <= stream.getTokenPosition(token_num));
+            CHECK(stream.getPair(stream.getPair(token_num)) == token_num);
+            if (stream[token_num].kind == TokenStream::OPEN)
+                CHECK(stream.getPair(token_num) > token_num);
+        }
+    }
+
+    /* <p>a<b>x<i>y</b>z<u>q</u></i>w</p>: </b> (12) закрывается раньше </i> (25) */
+    ParserTree tree("<p>a<b>x<i>y</b>z<u>q</u></i>w</p>", testKeySet());
+    TokenStream stream(tree.getKeyPositions());
+    const TokenStream::TokenKind kinds[] = { TokenStream::OPEN, TokenStream::OPEN, TokenStream::OPEN, TokenStream::CLOSE,
+                                             TokenStream::OPEN, TokenStream::CLOSE, TokenStream::CLOSE, TokenStream::CLOSE };
+    CHECK(stream.size() == 8);
+    for (std::size_t token_num = 0; token_num < 8 && token_num < stream.size(); token_num++)
+        CHECK(stream[token_num].kind == kinds[token_num]);
+    CHECK(stream.getTokenPosition(3) == 12 && stream.getTokenPosition(6) == 25);
+
+    /* range(): начало включается, конец - нет */
+    TokenStream::Range range = stream.range(12, 25);
+    CHECK(range.first == stream.begin() + 3 && range.second == stream.begin() + 6);
+    range = stream.range(13, 26);
+    CHECK(range.first == stream.begin() + 4 && range.second == stream.begin() + 7);
+    range = stream.range(0, 1000);
+    CHECK(range.first == stream.begin() && range.second == stream.end());
+    range = stream.range(1000, 2000);
+    CHECK(range.first == stream.end() && range.second == stream.end());
+}
+
+// Индекс слов: перекрывающиеся теги, отложенное дерево не строится целиком, поиск после изменения дерева
+static void testTextIndex()
+{
+    ParserTree::ParseOptions index_options;
+    index_options.text_index = true;
+    ParserTree overlapping_tree = makeTree("<p>a<b>x<i>y</b>z</i>w</p>", index_options);
+    CHECK(overlapping_tree.findText("w").getLastFind().size() == 1);
+    CHECK(overlapping_tree.findText("x").getLastFind().size() == 1);
+
+    std::string text = "<div><p>first <b>needle</b> word</p></div>";
+    for (int div_num = 0; div_num < 50; div_num++)
+        text += "<div><p>other <i>text</i></p><p>more</p></div>";
+
+    ParserTree eager_tree = makeTree(text);
+    ParserTree::ParseOptions lazy_options;
+    lazy_options.lazy_tree = true;
+    ParserTree lazy_tree = makeTree(text, lazy_options);
+    CHECK(lazy_tree.findText("needle").getLastFind().size() == 1);
+    CHECK(lazy_tree.getLastFind()[0]->getPreOrder() == eager_tree.findText("needle").getLastFind()[0]->getPreOrder());
+    CHECK(lazy_tree.findText("other text").getLastFind().empty());
+    CHECK(lazy_tree.findText("other").getLastFind().size() == 50);
+    CHECK(lazy_tree.findText("first").getLastFind().size() == 1);
+    CHECK(lazy_tree.getMemoryUsage().items < eager_tree.getMemoryUsage().items);
+
+    /* После отделения поддерева индекс строится по узлам */
+    ParserTree subtree = eager_tree.detachSubtree(*eager_tree.getRootItem().getChilds()[0]);
+    CHECK(eager_tree.findText("needle").getLastFind().empty());
+    CHECK(eager_tree.findText("more").getLastFind().size() == 50);
+    CHECK(subtree.findText("needle").getLastFind().size() == 1);
+}
+
+// Отделение поддерева и вставка в освобождённое место восстанавливают дерево
+static void testDetachSpliceRoundTrip()
+{
+    const std::string texts[] = {
+        "<div>A<p>B</p>C<i>D</i>E</div>",
+        "<div>\n  <p>B</p>\n  <i>D</i> E <u></u></div>",
+        "<p>a<b>x<i>y</b>z<u>q</u></i>w</p>"
+    };
+    for (const std::string& text : texts)
+    {
+        ParserTree reference_tree = makeTree(text);
+        const std::string reference_output = reference_tree.outASCIITree();
+        const unsigned long long reference_hash = reference_tree.getContentHash(reference_tree.getRootItem());
+
+        ParserTree tree = makeTree(text);
+        std::vector<const ParserTreeItem*> items;
+        for (const ParserTreeItem& item : preOrder(tree.getRootItem()))
+            if (&item != &tree.getRootItem())
+                items.push_back(&item);
+        for (const ParserTreeItem* p_item : items)
+        {
+            ParserTree::ItemSlot slot = { nullptr, 0 };
+            ParserTree subtree = tree.detachSubtree(*p_item, &slot);
+            CHECK(subtree.getErrorDescription().empty());
+            CHECK(slot.parent != nullptr);
+            CHECK(tree.getContentHash(tree.getRootItem()) != reference_hash);
+            CHECK(tree.spliceSubtree(slot, std::move(subtree)));
+            CHECK(tree.outASCIITree() == reference_output);
+            CHECK(tree.getContentHash(tree.getRootItem()) == reference_hash);
+            CHECK(tree.diff(reference_tree).empty());
+        }
+    }
+
+    /* Вставка по номеру дочернего узла - перед узлом, после предшествующих ему текстов */
+    ParserTree tree = makeTree("<div>A<p>B</p>C<i>D</i>E</div>");
+    const ParserTreeItem& div_item = *tree.getRootItem().getChilds()[0];
+    ParserTree subtree = tree.detachSubtree(*div_item.getChilds()[0]);
+    CHECK(tree.spliceSubtree(div_item, 0, std::move(subtree)));
+    CHECK(div_item.getTexts().size() == 3 && div_item.getChilds().size() == 2);
+    CHECK(div_item.getLocationSequenceOfData()[1] == ParserTreeItem::TEXT);
+    CHECK(div_item.getLocationSequenceOfData()[2] == ParserTreeItem::CHILD);
+    CHECK(*div_item.getTexts()[1] == "C");
+}
+
+// Перенос поддерева: хэши, ряды и номера совпадают с разбором переставленного текста, повторный createTree()
+static void testSubtreeMove()
+{
+    for (int lazy = 0; lazy < 2; lazy++)
+    {
+        ParserTree::ParseOptions options;
+        options.lazy_tree = lazy != 0;
+        ParserTree tree = makeTree("<div>A<p>B</p>C<i>D<b>x</b></i></div>", options);
+        ParserTree moved_tree = makeTree("<div>A<i>D<b>x</b></i><p>B</p>C</div>", options);
+        const ParserTreeItem& div_item = *tree.getRootItem().getChilds()[0];
+
+        ParserTree subtree = tree.detachSubtree(*div_item.getChilds()[1]);
+        CHECK(subtree.getRootItem().getChilds()[0]->getChilds()[0]->getRow() == 2);
+        CHECK(tree.spliceSubtree(div_item, 0, std::move(subtree)));
+        CHECK(tree.getContentHash(tree.getRootItem()) == moved_tree.getContentHash(moved_tree.getRootItem()));
+        CHECK(tree.diff(moved_tree).empty());
+        CHECK(tree.outASCIITree() == moved_tree.outASCIITree());
+        std::vector<ParserTreeItem*> b_items = tree.findItems(KeyType("<b> </b>"));
+        CHECK(b_items.size() == 1 && b_items[0]->getPreOrder() == 3 && b_items[0]->getRow() == 3);
+        CHECK(tree.getRootItem().getSubtreeEnd() == 5);
+
+        /* Два отделения без обновления индексов, возврат на места в обратном порядке */
+        ParserTree::ItemSlot p_slot = { nullptr, 0 }, i_slot = { nullptr, 0 };
+        ParserTree p_subtree = tree.detachSubtree(*div_item.getChilds()[1], &p_slot);
+        ParserTree i_subtree = tree.detachSubtree(*div_item.getChilds()[0], &i_slot);
+        CHECK(tree.findItems(KeyType("<p> </p>")).empty() && tree.getRootItem().getSubtreeEnd() == 2);
+        CHECK(tree.spliceSubtree(i_slot, std::move(i_subtree)));
+        CHECK(tree.spliceSubtree(p_slot, std::move(p_subtree)));
+        CHECK(tree.getContentHash(tree.getRootItem()) == moved_tree.getContentHash(moved_tree.getRootItem()));
+        CHECK(tree.outASCIITree() == moved_tree.outASCIITree());
+
+        /* Повторное построение дало бы вторые узлы для тех же ключей */
+        CHECK(!tree.createTree());
+        CHECK(tree.getErrorDescription().find("Tree is already created") != std::string::npos);
+        CHECK(tree.getRootItem().getSubtreeEnd() == 5);
+        ParserTree detached_tree = moved_tree.detachSubtree(*moved_tree.getRootItem().getChilds()[0]);
+        CHECK(!detached_tree.createTree());
+        CHECK(detached_tree.getRootItem().getChilds().size() == 1);
+    }
+}
+
+// Кэш: ошибочные деревья не сохраняются, рост памяти отложенного дерева учитывается сразу, один разбор на текст
+static void testParserCache()
+{
+    const std::string text = "<div><p>a <b>b</b></p><p>c</p></div><div><p>d</p></div>";
+    ParserCache cache(1 << 20);
+
+    ParseControl control;
+    control.cancel();
+    ParserTree::ParseOptions cancelled_options;
+    cancelled_options.control = &control;
+    std::shared_ptr<const ParserTree> cancelled_tree = cache.getTree(text, testKeySet(), cancelled_options);
+    CHECK(!cancelled_tree->getErrorDescription().empty());
+    CHECK(cache.getStatistics().entries == 0);
+    std::shared_ptr<const ParserTree> tree = cache.getTree(text, testKeySet());
+    CHECK(tree->getErrorDescription().empty());
+    CHECK(cache.getStatistics().entries == 1);
+
+    ParserTree::ParseOptions budget_options;
+    budget_options.memory_budget = 16;
+    CHECK(!cache.getTree(text, testKeySet(), budget_options)->getErrorDescription().empty());
+    CHECK(cache.getStatistics().entries == 1);
+
+    ParserTree::ParseOptions lazy_options;
+    lazy_options.lazy_tree = true;
+    std::shared_ptr<const ParserTree> lazy_tree = cache.getTree(text, testKeySet(), lazy_options);
+    std::size_t bytes = cache.getStatistics().bytes;
+    std::size_t count_items = 0;
+    for (const ParserTreeItem& item : preOrder(lazy_tree->getRootItem()))
+        count_items += item.getTexts().size() + 1;
+    CHECK(count_items > 3);
+    CHECK(cache.getStatistics().bytes > bytes);
+    CHECK(cache.getTree(text, testKeySet(), lazy_options) == lazy_tree);
+    CHECK(cache.getStatistics().hits == 1);
+
+    /* Поиск в общем дереве без изменения дерева */
+    KeyType p_key("<p> </p>");
+    CHECK(lazy_tree->findItems(p_key).size() == 3);
+    CHECK(lazy_tree->findNestedItems(lazy_tree->findItems(KeyType("<div> </div>")), KeyType("<b> </b>")).size() == 1);
+    CHECK(lazy_tree->findTextItems("d").size() == 1);
+    CHECK(lazy_tree->findTextItems("d")[0]->getParent() == lazy_tree->findItems(KeyType("<div> </div>"))[1]);
+
+    /* Одновременные запросы одного текста: разбор один, остальные потоки ждут его */
+    ParserCache shared_cache(1 << 20);
+    std::string big_text;
+    for (int div_num = 0; div_num < 2000; div_num++)
+        big_text += "<div><p>a <b>b</b></p><p>c</p></div>";
+    std::vector<std::shared_ptr<const ParserTree>> trees(8);
+    std::vector<std::thread> threads;
+    for (unsigned int thread_num = 0; thread_num < trees.size(); thread_num++)
+        threads.push_back(std::thread([&shared_cache, &big_text, &trees, thread_num]()
+        {
+            trees[thread_num] = shared_cache.getTree(big_text, testKeySet());
+        }));
+    for (std::thread& thread : threads)
+        thread.join();
+    CHECK(shared_cache.getStatistics().misses == 1 && shared_cache.getStatistics().hits == 7);
+    for (const std::shared_ptr<const ParserTree>& shared_tree : trees)
+        CHECK(shared_tree == trees[0]);
+}
+
+// Декодированные тексты: кэш узла, тексты после вставки поддерева
+static void testDecodedTexts()
+{
+    ParserTree tree = makeTree("<div>a &amp; b<p>x</p>c &lt; d</div>");
+    const ParserTreeItem& div_item = *tree.getRootItem().getChilds()[0];
+    CHECK(div_item.getDecodedText(1) == "c < d");
+    CHECK(div_item.getDecodedText(0) == "a & b");
+    CHECK(&div_item.getDecodedText(0) == &div_item.getDecodedText(0));
+    const ParserTreeItem& p_item = *div_item.getChilds()[0];
+    CHECK(&p_item.getDecodedText(0) == p_item.getTexts()[0]);
+
+    ParserTree::ItemSlot slot = { nullptr, 0 };
+    ParserTree subtree = tree.detachSubtree(p_item, &slot);
+    ParserTree inserted_tree = makeTree("&quot;q&quot;");
+    CHECK(tree.spliceSubtree(slot, std::move(inserted_tree)));
+    CHECK(div_item.getTexts().size() == 3);
+    CHECK(div_item.getDecodedText(1) == "\"q\"");
+    CHECK(div_item.getDecodedText(2) == "c < d");
+}
+
+// Границы 32-битных полей: позиции ключей после 4 ГБ, номера слов узла
+static void testPositionLimits()
+{
+    const std::size_t limit_32 = 0xFFFFFFFFULL;
+    const std::size_t max_position = static_cast<std::size_t>(KeyPositionType::MAX_POSITION);
+    KeyPositionType key_position(3, limit_32, max_position, limit_32 + 1, max_position - 0x10000);
+    CHECK(key_position.getTagId() == 3);
+    CHECK(key_position.getBeginKeyAreaPosition() == limit_32 && key_position.getBeginDataPosition() == limit_32 + 1);
+    CHECK(key_position.getEndKeyAreaPosition() == max_position && key_position.getEndDataPosition() == max_position - 0x10000);
+    key_position.setBeginDataPosition(limit_32 + 2);
+    CHECK(key_position.getBeginDataPosition() == limit_32 + 2 && key_position.getEndKeyAreaPosition() == max_position);
+
+    /* Поток ключей хранит такие позиции отдельно */
+    std::vector<KeyPositionType> key_positions(1, KeyPositionType(1, 10, 20, 13, 16));
+    key_positions.push_back(key_position);
+    TokenStream stream(key_positions);
+    CHECK(stream.size() == 4);
+    CHECK(!(stream[0].flags & TokenStream::LONG_POSITIONS) && (stream[2].flags & TokenStream::LONG_POSITIONS));
+    CHECK(stream.getTokenPosition(2) == limit_32 && stream.getTokenPosition(3) == max_position - 0x10000);
+    CHECK(stream.getPositions(3).end_key_area_pos == max_position);
+
+    /* Номер слова не переходит через TextIndex::MAX_WORD_NUM */
+    TextIndex text_index;
+    unsigned int word_num = TextIndex::MAX_WORD_NUM - 2;
+    CHECK(text_index.addText(1, "a", 1, word_num) && word_num == TextIndex::MAX_WORD_NUM);
+    word_num = TextIndex::MAX_WORD_NUM - 1;
+    CHECK(!text_index.addText(1, "b c", 3, word_num) && word_num == TextIndex::MAX_WORD_NUM - 1);
+    CHECK(text_index.findPhrase("a").size() == 1 && text_index.findPhrase("b").empty());
+}
+
+// Бюджет памяти: учитывается ёмкость вектора местоположений, а не количество ключей
+static void testMemoryBudget()
+{
+    std::string text;
+    for (int p_num = 0; p_num < 100; p_num++)
+        text += "<p>t</p>";
+    unsigned int count_accepted = 0;
+    for (std::size_t memory_budget = text.size(); memory_budget < text.size() + 150 * sizeof(KeyPositionType); memory_budget += 7)
+    {
+        ParserTree::ParseOptions options;
+        options.memory_budget = memory_budget;
+        ParserTree tree(text, testKeySet(), options);
+        if (!tree.getErrorDescription().empty())
+        {
+            CHECK(tree.getKeyPositions().empty());
+            continue;
+        }
+        count_accepted++;
+        CHECK(tree.getKeyPositions().size() == 100);
+        CHECK(text.size() + tree.getKeyPositions().capacity() * sizeof(KeyPositionType) <= memory_budget);
+    }
+    CHECK(count_accepted > 0);
+}
+
+// Вывод дерева: отмена через ParseControl
+static void testOutputCancel()
+{
+    ParserTree tree = makeTree("<div><p>a</p><p>b</p></div>");
+    ParseControl control;
+    CHECK(tree.outASCIITree(&control) == tree.outASCIITree());
+    CHECK(!tree.outASCIITree().empty());
+    control.cancel();
+    CHECK(tree.outASCIITree(&control).empty());
+}
+
+// Строки и колонки: CRLF, последняя строка без перевода строки, конец текста, позиция ошибки
+static void testLineColumn()
+{
+    const std::string text = "<p>a</p>\r\n<p>b</p>\r\n<i>x</i>";
+    ParserTree::ParseOptions options;
+    options.line_index = true;
+    ParserTree tree = makeTree(text, options);
+    CHECK(tree.getErrorDescription().empty());
+
+    const std::size_t offsets[] = { 0, 8, 9, 10, 20, 23, text.size() };
+    const std::size_t lines[] = { 1, 1, 1, 2, 3, 3, 3 };
+    const std::size_t columns[] = { 1, 9, 10, 1, 1, 4, 9 };
+    for (unsigned int offset_num = 0; offset_num < sizeof(offsets) / sizeof(*offsets); offset_num++)
+    {
+        ParserTree::LineColumn line_column = tree.lineColumn(offsets[offset_num]);
+        CHECK(line_column.line == lines[offset_num] && line_column.column == columns[offset_num]);
+    }
+
+    ParserTree::LineColumn root_line_column = tree.getItemLineColumn(tree.getRootItem());
+    CHECK(root_line_column.line == 1 && root_line_column.column == 1);
+    const ParserTreeItem& i_item = *tree.getRootItem().getChilds().back();
+    CHECK(i_item.getTexts().size() == 1 && *i_item.getTexts()[0] == "x");
+    ParserTree::LineColumn i_line_column = tree.getItemLineColumn(i_item);
+    CHECK(i_line_column.line == 3 && i_line_column.column == 1);
+
+    /* Незакрытый тег: в описании ошибки - позиция, строка и колонка */
+    ParserTree broken_tree("<p>a</p>\r\n<p>b", testKeySet());
+    CHECK(broken_tree.getErrorDescription().find("search start from 13, line 2, column 4") != std::string::npos);
+}
+
+// Выборочное извлечение элементов: позиция остановки
+static void testElementExtractor()
+{
+    KeySet key_set = testKeySet();
+    ElementExtractor extractor(key_set, std::vector<std::string>(1, "div/p"));
+    CHECK(extractor.getErrorDescription().empty());
+    const std::string text = "<div><p>first</p></div><div><p>second</p></div>";
+    std::vector<std::vector<KeyPositionType>> results;
+    std::size_t scanned = extractor.extract(text, results);
+    CHECK(scanned == text.find("</div>"));
+    CHECK(results.size() == 1 && results[0].size() == 1);
+    CHECK(results[0][0].getBeginKeyAreaPosition() == 5);
+    CHECK(results[0][0].getEndKeyAreaPosition() == 17);
+}
+
+// Разбиение на слова: разделители U+0080..U+00BF и U+2000..U+206F, верхние индексы входят в слово
+static void testSplitWords()
+{
+    std::vector<std::string> words;
+    const std::string text = "Ёлка\xE2\x80\x94x\xE2\x81\xB7 a\xE2\x81\xAF" "b\xC2\xA0" "C";
+    splitWords(text.data(), text.size(), words);
+    CHECK(words.size() == 5);
+    CHECK(words.size() == 5 && words[0] == "елка" && words[1] == "x\xE2\x81\xB7" && words[2] == "a"
+          && words[3] == "b" && words[4] == "c");
+
+    /* ¹ ² ³ µ в диапазоне C2 - части слов, ° и « » - разделители */
+    const std::string latin1_texts[] = { "x\xC2\xB9", "\xD0\xBC\xC2\xB2", "\xD0\xBC\xC2\xB3", "\xC2\xB5m" };
+    for (const std::string& latin1_text : latin1_texts)
+    {
+        words.clear();
+        splitWords(latin1_text.data(), latin1_text.size(), words);
+        CHECK(words.size() == 1 && words[0] == latin1_text);
+    }
+    words.clear();
+    const std::string separated_text = "\xC2\xAB" "a\xC2\xB0" "b\xC2\xBB";
+    splitWords(separated_text.data(), separated_text.size(), words);
+    CHECK(words.size() == 2 && words[0] == "a" && words[1] == "b");
+}
+
+// Извлечение строк таблиц: вложенные таблицы, незакрытые ячейки, CSV и столбцы
+static void testTableExtractor()
+{
+    /** Получатель строк: сохраняет строки с копиями ячеек */
+    struct RowCollector : public TableRowHandler
+    {
+        std::vector<std::pair<unsigned int, std::vector<std::string>>> rows;
+        void addRow(const TableRow& row) override
+        {
+            std::vector<std::string> cells;
+            for (const TextView& cell : row.cells)
+                cells.push_back(cell.toString());
+            rows.push_back(std::make_pair(row.table_num, cells));
+        }
+    };
+
+    const std::string text = "<TABLE><tr><th>Name</th><th>Value</th></tr>"
+                             "<tr><td> a, \"b\" </td><td>1<table><tr><td>in<td>x</table></td></tr>"
+                             "<tr><td>c &amp; <b>d</b><td/><!-- <td>no</td> --></tr>"
+                             "<script>\"<td>no</td>\"</script></table><td>outside</td>"
+                             "<table><tr><td>unclosed";
+    TableExtractor extractor;
+    RowCollector collector;
+    CHECK(extractor.extract(text, collector) == 5);
+    CHECK(collector.rows.size() == 5);
+    if (collector.rows.size() == 5)
+    {
+        CHECK(collector.rows[0].first == 0 && collector.rows[0].second.size() == 2);
+        CHECK(collector.rows[1].first == 1 && collector.rows[1].second[0] == "in");
+        CHECK(collector.rows[2].second[0] == "a, \"b\"");
+        CHECK(collector.rows[3].second.size() == 2 && collector.rows[3].second[1].empty());
+        CHECK(collector.rows[4].first == 2 && collector.rows[4].second[0] == "unclosed");
+    }
+
+    std::ostringstream csv;
+    CsvTableWriter writer(csv);
+    extractor.extract(text, writer);
+    CHECK(csv.str().find("0,\"a, \"\"b\"\"\",1 in x\r\n") != std::string::npos);
+    CHECK(csv.str().find("0,c & d,\r\n") != std::string::npos);
+
+    ColumnarTable columns(0);
+    extractor.extract(text, columns);
+    CHECK(columns.getRowsCount() == 3 && columns.getColumnsCount() == 2);
+    CHECK(columns.getCell(2, 0).toString() == "c &amp; <b>d</b>");
+
+    /* Обрывки тегов в конце текста */
+    const std::string broken_texts[] = { "<table><tr><td>a</td", "<table><tr><td", "<table><", "<td>a</td></table>" };
+    for (const std::string& broken_text : broken_texts)
+    {
+        RowCollector broken_collector;
+        extractor.extract(broken_text, broken_collector);
+        CHECK(broken_collector.rows.size() <= 1);
+    }
+}
+
+// Случайные искажённые тексты: отложенное дерево совпадает с обычным, индексы не выходят за границы текста
+static void testMalformedTexts()
+{
+    const char* parts[] = { "<div>", "</div>", "<p>", "</p>", "<b>", "</b>", "<i>", "</i>", "<u>", "</u>",
+                            "<a href=\"x>y\">", "</a>", "word ", "other ", "&amp;", "\n", " ", "<!-- c -->", "<", ">" };
+    const unsigned int count_parts = sizeof(parts) / sizeof(*parts);
+    unsigned int random = 12345;
+    unsigned int count_built = 0;
+    for (unsigned int text_num = 0; text_num < 300; text_num++)
+    {
+        std::string text;
+        unsigned int count_text_parts = 1 + text_num % 24;
+        for (unsigned int part_num = 0; part_num < count_text_parts; part_num++)
+        {
+            random = random * 1103515245 + 12345;
+            text += parts[(random >> 16) % count_parts];
+        }
+
+        ParserTree::ParseOptions options;
+        options.text_index = true;
+        options.line_index = true;
+        ParserTree tree = makeTree(text, options);
+        ParserTree::ParseOptions lazy_options;
+        lazy_options.lazy_tree = true;
+        ParserTree lazy_tree = makeTree(text, lazy_options);
+        CHECK(tree.getErrorDescription().empty() == lazy_tree.getErrorDescription().empty());
+        if (!tree.getErrorDescription().empty() || !lazy_tree.getErrorDescription().empty())
+            continue;
+        count_built++;
+
+        CHECK(lazy_tree.findText("word").getLastFind().size() == tree.findText("word").getLastFind().size());
+        CHECK(lazy_tree.outASCIITree() == tree.outASCIITree());
+        CHECK(lazy_tree.getContentHash(lazy_tree.getRootItem()) == tree.getContentHash(tree.getRootItem()));
+
+        std::size_t count_pre_order = 0, count_post_order = 0;
+        for (const ParserTreeItem& item : preOrder(tree.getRootItem()))
+        {
+            CHECK(item.getPreOrder() == count_pre_order);
+            count_pre_order++;
+            if (&item != &tree.getRootItem())
+                CHECK(tree.getItemLineColumn(item).line >= 1);
+        }
+        for (const ParserTreeItem& item : postOrder(tree.getRootItem()))
+        {
+            (void)item;
+            count_post_order++;
+        }
+        CHECK(count_pre_order == count_post_order);
+        CHECK(count_pre_order == tree.getRootItem().getSubtreeEnd());
+    }
+    CHECK(count_built > 0);
+}
+
+//=================================================================
+
+int main()
+{
+    testHtmlEntities();
+    testWhitespaceModes();
+    testTagIds();
+    testNesting();
+    testMemoryUsage();
+    testCaseInsensitiveKeys();
+    testUnterminatedTags();
+    testOverlappingTags();
+    testTokenStream();
+    testTextIndex();
+    testDetachSpliceRoundTrip();
+    testSubtreeMove();
+    testParserCache();
+    testDecodedTexts();
+    testPositionLimits();
+    testMemoryBudget();
+    testOutputCancel();
+    testLineColumn();
+    testElementExtractor();
+    testSplitWords();
+    testTableExtractor();
+    testMalformedTexts();
+
+    if (count_failed == 0)
+        std::cout << "All checks passed" << std::endl;
+    return static_cast<int>(count_failed);
+}
@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Regression checks of the parser (console, without GUI)
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+CONFIG   += console c++11 testcase
+CONFIG   -= app_bundle
+
+TARGET = parser_tests
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += parser_tests.cpp \
+    ../parser.cpp \
+    ../search_functions.cpp \
+    ../text_functions.cpp \
+    ../token_stream.cpp \
+    ../tag_scanner.cpp \
+    ../parser_cache.cpp
+
+HEADERS  += ../parser.h \
+    ../parser_cache.h
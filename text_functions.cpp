@@ -0,0 +1,521 @@
+#include "parser.h"
+#include <cstring>
+#include <cctype>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARSER_USE_SSE2
+#endif
+
+/** Запись символа в кодировке UTF-8
+ * @param [out] output - строка, в конец которой записывается символ
+ * @param [in] code_point - код символа
+ */
+static void appendUtf8(std::string& output, unsigned long code_point);
+
+/** Поиск именованной сущности
+ * @param [in] name - начало имени сущности (без '&')
+ * @param [in] length - длина имени (без ';')
+ * @return код символа или 0, если сущность неизвестна
+ */
+static unsigned long findNamedEntity(const char* name, std::size_t length);
+
+//=================================================================
+
+// Проверка наличия байта:
+bool containsByte(const char* data, std::size_t size, char byte)
+{
+    std::size_t pos = 0;
+#ifdef PARSER_USE_SSE2
+    /* Сравниваем по 16 байт за раз */
+    const __m128i needle = _mm_set1_epi8(byte);
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)) != 0)
+            return true;
+    }
+#endif
+    /* Остаток (или вся строка без SSE2) */
+    return std::memchr(data + pos, byte, size - pos) != nullptr;
+}
+
+
+#ifdef PARSER_USE_SSE2
+/** Приведение 16 байт к нижнему регистру ASCII
+ * @param [in] chunk - байты
+ * @return байты, в которых 'A'..'Z' заменены на 'a'..'z'
+ */
+static inline __m128i toLowerAsciiChunk(__m128i chunk)
+{
+    /* Байты >= 0x80 отрицательны при знаковом сравнении и не попадают в диапазон */
+    __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)),
+                                     _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(chunk, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+/** Номер младшего установленного бита
+ * @param [in] mask - ненулевая маска
+ * @return номер бита
+ */
+static inline unsigned int lowestBitNum(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    unsigned int bit = 0;
+    while ((mask & (1u << bit)) == 0)
+        bit++;
+    return bit;
+#endif
+}
+
+/** Приведение байта к нижнему регистру ASCII
+ * @param [in] c - байт
+ * @return байт, в котором 'A'..'Z' заменены на 'a'..'z'
+ */
+static inline char toLowerAsciiChar(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+}
+
+
+// Поиск начал строк:
+void findLineStarts(const std::string& text, std::vector<std::size_t>& line_starts)
+{
+    const char* data = text.data();
+    const std::size_t size = text.size();
+    line_starts.push_back(0);
+    std::size_t pos = 0;
+#ifdef PARSER_USE_SSE2
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        while (mask != 0)
+        {
+            line_starts.push_back(pos + lowestBitNum(mask) + 1);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    /* Остаток (или весь текст без SSE2) */
+    while (pos < size)
+    {
+        const char* p_found = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+        if (p_found == nullptr)
+            break;
+        pos = p_found - data + 1;
+        line_starts.push_back(pos);
+    }
+}
+
+
+// Сравнение без учёта регистра ASCII:
+bool equalsIgnoreAsciiCase(const char* a, const char* b, std::size_t size)
+{
+    std::size_t pos = 0;
+#ifdef PARSER_USE_SSE2
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk_a = toLowerAsciiChunk(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + pos)));
+        __m128i chunk_b = toLowerAsciiChunk(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + pos)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk_a, chunk_b)) != 0xFFFF)
+            return false;
+    }
+#endif
+    for (; pos < size; pos++)
+        if (toLowerAsciiChar(a[pos]) != toLowerAsciiChar(b[pos]))
+            return false;
+    return true;
+}
+
+
+// Поиск подстроки без учёта регистра ASCII:
+std::string::size_type findIgnoreAsciiCase(const std::string& s, const std::string& pattern, std::string::size_type pos)
+{
+    if (pattern.empty())
+        return pos <= s.size() ? pos : std::string::npos;
+    if (pos >= s.size() || s.size() - pos < pattern.size())
+        return std::string::npos;
+
+    const char* data = s.data();
+    const std::size_t last_pos = s.size() - pattern.size();     // Последняя возможная позиция вхождения
+    const char first = toLowerAsciiChar(pattern[0]);
+#ifdef PARSER_USE_SSE2
+    /* Кандидаты - позиции, где совпадают первый и последний байты образца (по 16 позиций за раз) */
+    const char last = toLowerAsciiChar(pattern[pattern.size() - 1]);
+    const __m128i first_needle = _mm_set1_epi8(first);
+    const __m128i last_needle = _mm_set1_epi8(last);
+    for (; pos + 16 <= last_pos + 1; pos += 16)
+    {
+        __m128i first_chunk = toLowerAsciiChunk(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos)));
+        __m128i last_chunk = toLowerAsciiChunk(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + pattern.size() - 1)));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first_chunk, first_needle),
+                                                             _mm_cmpeq_epi8(last_chunk, last_needle)));
+        while (mask != 0)
+        {
+            unsigned int bit = lowestBitNum(mask);
+            if (equalsIgnoreAsciiCase(data + pos + bit + 1, pattern.data() + 1, pattern.size() - 1))
+                return pos + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    /* Остаток (или вся строка без SSE2) */
+    for (; pos <= last_pos; pos++)
+        if (toLowerAsciiChar(data[pos]) == first && equalsIgnoreAsciiCase(data + pos + 1, pattern.data() + 1, pattern.size() - 1))
+            return pos;
+    return std::string::npos;
+}
+
+
+// Приведение к нижнему регистру ASCII:
+std::string toLowerAscii(const std::string& text)
+{
+    std::string output(text);
+    std::size_t pos = 0;
+#ifdef PARSER_USE_SSE2
+    for (; pos + 16 <= output.size(); pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(output.data() + pos));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&output[pos]), toLowerAsciiChunk(chunk));
+    }
+#endif
+    for (; pos < output.size(); pos++)
+        output[pos] = toLowerAsciiChar(output[pos]);
+    return output;
+}
+
+
+// Разбиение на нормализованные слова:
+void splitWords(const char* data, std::size_t size, std::vector<std::string>& words)
+{
+    std::string word;
+    std::size_t pos = 0;
+    while (pos < size)
+    {
+        unsigned char c = static_cast<unsigned char>(data[pos]);
+        /* ASCII: буквы и цифры входят в слово, остальное - разделители */
+        if (c < 0x80)
+        {
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+                word += static_cast<char>(c);
+            else if (c >= 'A' && c <= 'Z')
+                word += static_cast<char>(c | 0x20);
+            else if (!word.empty())
+            {
+                words.push_back(word);
+                word.clear();
+            }
+            pos++;
+            continue;
+        }
+
+        /* Символ UTF-8: длина по первому байту (ошибочный байт - разделитель) */
+        std::size_t length = c >= 0xF8 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+        unsigned char c2 = pos + 1 < size ? static_cast<unsigned char>(data[pos + 1]) : 0;
+        unsigned char c3 = pos + 2 < size ? static_cast<unsigned char>(data[pos + 2]) : 0;
+        /* Разделители U+0080..U+00BF (C2 xx), кроме букв и цифр ª ² ³ µ ¹ º ¼ ½ ¾ ("м²"),
+         *   и U+2000..U+206F (E2 80 xx, E2 81 80..AF), но не U+2070.. ("x⁷") */
+        bool is_latin1_word_char = c2 == 0xAA || c2 == 0xB2 || c2 == 0xB3 || c2 == 0xB5 || (c2 >= 0xB9 && c2 <= 0xBA)
+                                   || (c2 >= 0xBC && c2 <= 0xBE);
+        bool is_separator = (c == 0xC2 && !is_latin1_word_char) || (c == 0xE2 && (c2 == 0x80 || (c2 == 0x81 && c3 < 0xB0)));
+        if (length == 0 || pos + length > size || is_separator)
+        {
+            if (!word.empty())
+            {
+                words.push_back(word);
+                word.clear();
+            }
+            pos += length == 0 || pos + length > size ? 1 : length;
+            continue;
+        }
+
+        /* Кириллица: А..Я -> а..я, Ё и ё -> е */
+        if (c == 0xD0 && c2 >= 0x90 && c2 <= 0x9F)
+            word.append({static_cast<char>(0xD0), static_cast<char>(c2 + 0x20)});
+        else if (c == 0xD0 && c2 >= 0xA0 && c2 <= 0xAF)
+            word.append({static_cast<char>(0xD1), static_cast<char>(c2 - 0x20)});
+        else if ((c == 0xD0 && c2 == 0x81) || (c == 0xD1 && c2 == 0x91))
+            word.append({static_cast<char>(0xD0), static_cast<char>(0xB5)});
+        else
+            word.append(data + pos, length);
+        pos += length;
+    }
+    if (!word.empty())
+        words.push_back(word);
+}
+
+
+// Декодирование HTML-сущностей:
+std::string decodeHtmlEntities(const std::string& text)
+{
+    std::string output;
+    output.reserve(text.size());
+
+    std::size_t text_pos = 0;
+    while (text_pos < text.size())
+    {
+        std::size_t amp_pos = text.find('&', text_pos);
+        if (amp_pos == std::string::npos)
+            break;
+        output.append(text, text_pos, amp_pos - text_pos);
+
+        /* Сущность заканчивается ';' не далее 32 символов от '&' */
+        std::size_t semicolon_pos = text.find(';', amp_pos + 1);
+        unsigned long code_point = 0;
+        if (semicolon_pos != std::string::npos && semicolon_pos - amp_pos <= 32 && semicolon_pos > amp_pos + 1)
+        {
+            const char* p_name = text.data() + amp_pos + 1;
+            std::size_t name_length = semicolon_pos - amp_pos - 1;
+            if (p_name[0] == '#')
+            {
+                /* Числовая сущность: &#1234; или &#x4D2; */
+                bool is_hex = name_length > 1 && (p_name[1] == 'x' || p_name[1] == 'X');
+                std::size_t digit_pos = is_hex ? 2 : 1;
+                bool valid = digit_pos < name_length;
+                for (; valid && digit_pos < name_length && code_point <= 0x10FFFF; digit_pos++)
+                {
+                    char c = p_name[digit_pos];
+                    if (c >= '0' && c <= '9')
+                        code_point = code_point * (is_hex ? 16 : 10) + (c - '0');
+                    else if (is_hex && c >= 'a' && c <= 'f')
+                        code_point = code_point * 16 + (c - 'a' + 10);
+                    else if (is_hex && c >= 'A' && c <= 'F')
+                        code_point = code_point * 16 + (c - 'A' + 10);
+                    else
+                        valid = false;
+                }
+                if (!valid)
+                    code_point = 0;
+                else if (code_point == 0 || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF))
+                    code_point = 0xFFFD;    // Недопустимый символ
+            }
+            else
+                code_point = findNamedEntity(p_name, name_length);
+        }
+
+        /* Неизвестную сущность оставляем как есть */
+        if (code_point == 0)
+        {
+            output += '&';
+            text_pos = amp_pos + 1;
+            continue;
+        }
+        appendUtf8(output, code_point);
+        text_pos = semicolon_pos + 1;
+    }
+    output.append(text, text_pos, std::string::npos);
+
+    return output;
+}
+
+
+// Видимый текст фрагмента HTML:
+std::string htmlToPlainText(const char* data, std::size_t size)
+{
+    std::string text;
+    text.reserve(size);
+
+    bool pending_space = false;     // Пропущены пробельные символы или тег
+    std::size_t pos = 0;
+    while (pos < size)
+    {
+        char c = data[pos];
+        if (c == '<' && pos + 1 < size)
+        {
+            /* Комментарий или тег: "<!-- -->", "<a ...>", "</a>", "<!...>" */
+            char next = data[pos + 1];
+            const char* p_end = nullptr;
+            if (size - pos >= 4 && std::memcmp(data + pos, "<!--", 4) == 0)
+            {
+                for (std::size_t end_pos = pos + 4; end_pos + 3 <= size && p_end == nullptr; end_pos++)
+                    if (std::memcmp(data + end_pos, "-->", 3) == 0)
+                        p_end = data + end_pos + 2;
+                if (p_end == nullptr)
+                    p_end = data + size - 1;
+            }
+            else if (next == '/' || next == '!' || next == '?' || std::isalpha(static_cast<unsigned char>(next)))
+                p_end = static_cast<const char*>(std::memchr(data + pos, '>', size - pos));
+            if (p_end != nullptr)
+            {
+                pos = p_end - data + 1;
+                pending_space = true;
+                continue;
+            }
+        }
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f')
+        {
+            pending_space = true;
+            pos++;
+            continue;
+        }
+        if (pending_space && !text.empty())
+            text += ' ';
+        pending_space = false;
+        text += c;
+        pos++;
+    }
+
+    return containsByte(text.data(), text.size(), '&') ? decodeHtmlEntities(text) : text;
+}
+
+
+// Хэш последовательности байт:
+unsigned long long hashBytes(const char* data, std::size_t size, unsigned long long seed)
+{
+    const unsigned long long m = 0xC6A4A7935BD1E995ULL;
+    const int r = 47;
+    unsigned long long hash = seed ^ (size * m);
+
+    std::size_t pos = 0;
+    for (; pos + 8 <= size; pos += 8)
+    {
+        unsigned long long k;
+        std::memcpy(&k, data + pos, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        hash ^= k;
+        hash *= m;
+    }
+
+    /* Оставшиеся байты */
+    std::size_t rest = size - pos;
+    if (rest != 0)
+    {
+        unsigned long long k = 0;
+        for (std::size_t i = 0; i < rest; i++)
+            k |= static_cast<unsigned long long>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+        hash ^= k;
+        hash *= m;
+    }
+
+    hash ^= hash >> r;
+    hash *= m;
+    hash ^= hash >> r;
+    return hash;
+}
+
+
+// Поиск значения атрибута тега:
+bool findAttributeValue(const std::string& text, std::size_t begin_tag_pos, std::size_t end_tag_pos,
+                        const std::string& attribute_name, std::string& value)
+{
+    const char* const spaces = " \t\r\n\f";
+    /* Пропускаем имя тега */
+    std::string::size_type pos = text.find_first_of(" \t\r\n\f/>", begin_tag_pos + 1);
+    while (pos < end_tag_pos)
+    {
+        pos = text.find_first_not_of(spaces, pos);
+        if (pos >= end_tag_pos || text[pos] == '>')
+            break;
+        if (text[pos] == '/')
+        {
+            pos++;
+            continue;
+        }
+
+        /* Имя атрибута (сравнение без учёта регистра ASCII) */
+        std::string::size_type end_name = text.find_first_of(" \t\r\n\f=/>", pos);
+        if (end_name > end_tag_pos)
+            end_name = end_tag_pos;
+        bool same_name = end_name - pos == attribute_name.size();
+        for (std::string::size_type i = 0; same_name && i < attribute_name.size(); i++)
+            same_name = std::tolower(static_cast<unsigned char>(text[pos + i])) == std::tolower(static_cast<unsigned char>(attribute_name[i]));
+
+        /* Значение атрибута */
+        std::string::size_type begin_value = text.find_first_not_of(spaces, end_name);
+        std::string::size_type end_value = end_name;
+        if (begin_value < end_tag_pos && text[begin_value] == '=')
+        {
+            begin_value = text.find_first_not_of(spaces, begin_value + 1);
+            if (begin_value >= end_tag_pos)
+                break;
+            if (text[begin_value] == '"' || text[begin_value] == '\'')
+            {
+                end_value = text.find(text[begin_value], begin_value + 1);
+                if (end_value > end_tag_pos)
+                    end_value = end_tag_pos;
+                begin_value++;
+                pos = end_value + 1;
+            }
+            else
+            {
+                end_value = text.find_first_of(" \t\r\n\f>", begin_value);
+                if (end_value > end_tag_pos)
+                    end_value = end_tag_pos;
+                pos = end_value;
+            }
+        }
+        else
+        {
+            begin_value = end_name;     // Атрибут без значения
+            pos = end_name;
+        }
+
+        if (same_name)
+        {
+            value.assign(text, begin_value, end_value - begin_value);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//=================================================================
+
+/* === Other funtion === */
+void appendUtf8(std::string& output, unsigned long code_point)
+{
+    if (code_point < 0x80)
+        output += static_cast<char>(code_point);
+    else if (code_point < 0x800)
+    {
+        output += static_cast<char>(0xC0 | (code_point >> 6));
+        output += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    else if (code_point < 0x10000)
+    {
+        output += static_cast<char>(0xE0 | (code_point >> 12));
+        output += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    else
+    {
+        output += static_cast<char>(0xF0 | (code_point >> 18));
+        output += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        output += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+}
+
+unsigned long findNamedEntity(const char* name, std::size_t length)
+{
+    struct NamedEntity
+    {
+        const char* name;
+        unsigned long code_point;
+    };
+    // Отсортированы по имени (для двоичного поиска)
+    static const NamedEntity entities[] = {
+        {"amp", '&'}, {"apos", '\''}, {"bull", 0x2022}, {"copy", 0xA9}, {"deg", 0xB0},
+        {"euro", 0x20AC}, {"gt", '>'}, {"hellip", 0x2026}, {"laquo", 0xAB}, {"ldquo", 0x201C},
+        {"lt", '<'}, {"mdash", 0x2014}, {"middot", 0xB7}, {"nbsp", 0xA0}, {"ndash", 0x2013},
+        {"quot", '"'}, {"raquo", 0xBB}, {"rdquo", 0x201D}, {"reg", 0xAE}, {"times", 0xD7},
+        {"trade", 0x2122}
+    };
+    const NamedEntity* p_begin = entities;
+    const NamedEntity* p_end = entities + sizeof(entities) / sizeof(*entities);
+
+    const std::string entity_name(name, length);
+    const NamedEntity* p_found = std::lower_bound(p_begin, p_end, entity_name,
+        [](const NamedEntity& entity, const std::string& s) { return s.compare(entity.name) > 0; });
+    if (p_found != p_end && entity_name == p_found->name)
+        return p_found->code_point;
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "parser.h"
+
+static_assert(sizeof(TokenStream::Token) == 16, "TokenStream::Token must stay packed in 16 bytes");
+
+/* === TokenStream === */
+// Конструктор:
+TokenStream::TokenStream(const std::vector<KeyPositionType>& key_positions, bool build_pairs)
+{
+    /* Каждый ключ с данными даёт два элемента, пустой - один */
+    tokens.reserve(key_positions.size() * 2);
+    if (build_pairs)
+        pairs.reserve(key_positions.size() * 2);
+
+    auto push_token = [this, build_pairs](const KeyPositionType& key_position, TokenKind kind)
+    {
+        const KeyPositionType::Positions poss = key_position.getPositions();
+        std::size_t begin_data_offset = poss.begin_data_pos - poss.begin_key_area_pos;
+        std::size_t end_key_area_offset = poss.end_key_area_pos - poss.end_data_pos;
+
+        Token token = { static_cast<unsigned int>(poss.begin_key_area_pos), static_cast<unsigned int>(poss.end_data_pos),
+                        static_cast<unsigned short>(begin_data_offset), static_cast<unsigned short>(end_key_area_offset),
+                        key_position.getTagId(), static_cast<unsigned char>(kind), 0 };
+        if (begin_data_offset > 0xFFFF || end_key_area_offset > 0xFFFF || static_cast<unsigned long long>(poss.end_key_area_pos) > 0xFFFFFFFFULL)
+        {
+            token.flags |= LONG_POSITIONS;
+            long_positions[tokens.size()] = poss;
+        }
+        tokens.push_back(token);
+        if (build_pairs)
+            pairs.push_back(tokens.size() - 1);
+    };
+
+    /* Незакрытые ключи и номера их элементов OPEN. При перекрывающихся тегах ключи закрываются не в обратном
+     *   порядке открытия, поэтому храним их в куче: сверху ключ с наименьшим концом данных, при равных концах -
+     *   открытый последним. Так элементы CLOSE идут в порядке возрастания позиций */
+    typedef std::pair<const KeyPositionType*, unsigned int> OpenKey;
+    auto close_later = [](const OpenKey& left, const OpenKey& right)
+    {
+        std::size_t left_end = left.first->getEndDataPosition(), right_end = right.first->getEndDataPosition();
+        return left_end > right_end || (left_end == right_end && left.second < right.second);
+    };
+    std::vector<OpenKey> open_keys;
+    auto close_first_key = [this, build_pairs, &open_keys, &push_token, &close_later]()
+    {
+        std::pop_heap(open_keys.begin(), open_keys.end(), close_later);
+        push_token(*open_keys.back().first, CLOSE);
+        if (build_pairs)
+        {
+            pairs[open_keys.back().second] = tokens.size() - 1;
+            pairs.back() = open_keys.back().second;
+        }
+        open_keys.pop_back();
+    };
+
+    for (const KeyPositionType& key_position : key_positions)
+    {
+        /* Закрываем ключи, данные которых закончились до начала текущего */
+        while (!open_keys.empty() && open_keys.front().first->getEndDataPosition() <= key_position.getBeginKeyAreaPosition())
+            close_first_key();
+
+        if (key_position.getEndDataPosition() == key_position.getEndKeyAreaPosition())
+            push_token(key_position, EMPTY);
+        else
+        {
+            open_keys.push_back(OpenKey(&key_position, tokens.size()));
+            std::push_heap(open_keys.begin(), open_keys.end(), close_later);
+            push_token(key_position, OPEN);
+        }
+    }
+    while (!open_keys.empty())
+        close_first_key();
+}
+
+
+// Позиция элемента:
+std::size_t TokenStream::getTokenPosition(std::size_t token_num) const
+{
+    const Token& token = tokens[token_num];
+    if (token.flags & LONG_POSITIONS)
+    {
+        const KeyPositionType::Positions& poss = long_positions.find(token_num)->second;
+        return token.kind == CLOSE ? poss.end_data_pos : poss.begin_key_area_pos;
+    }
+    return token.kind == CLOSE ? token.end_data_pos : token.begin_key_area_pos;
+}
+
+// Полное местоположение ключа:
+KeyPositionType::Positions TokenStream::getPositions(std::size_t token_num) const
+{
+    const Token& token = tokens[token_num];
+    if (token.flags & LONG_POSITIONS)
+        return long_positions.find(token_num)->second;
+
+    KeyPositionType::Positions poss = {
+        token.begin_key_area_pos, token.end_data_pos + token.end_key_area_offset,
+        token.begin_key_area_pos + token.begin_data_offset, token.end_data_pos };
+    return poss;
+}
+
+
+// Отрезки потока:
+TokenStream::Range TokenStream::range(std::size_t begin_pos, std::size_t end_pos) const
+{
+    /* Позиции элементов не убывают, поэтому используем двоичный поиск */
+    auto position_less = [this](const Token& token, std::size_t pos)
+    {
+        return getTokenPosition(&token - tokens.data()) < pos;
+    };
+    const_iterator first = std::lower_bound(begin(), end(), begin_pos, position_less);
+    const_iterator last = std::lower_bound(first, end(), end_pos, position_less);
+    return Range(first, last);
+}
+
+TokenStream::Range TokenStream::elementRange(std::size_t token_num) const
+{
+    return Range(begin() + token_num, begin() + pairs[token_num] + 1);
+}